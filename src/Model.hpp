@@ -22,6 +22,7 @@
 
 #include <SDL.h>
 
+#include <cstdint>
 #include <cstdlib>
 
 struct ModelFrame
@@ -37,12 +38,40 @@ class Model
             return rand() % (min - max) + min;
         }
 
+        /**
+         * Returns a thoroughly scrambled hash of `key`. Hashing a counter
+         * gives a random stream which can be indexed directly, so threads
+         * can draw numbers without sharing any state.
+         */
+        static std::uint64_t mix(std::uint64_t key)
+        {
+            // The SplitMix64 finalizer.
+            key += UINT64_C(0x9E3779B97F4A7C15);
+            key = (key ^ (key >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+            key = (key ^ (key >> 27)) * UINT64_C(0x94D049BB133111EB);
+            return key ^ (key >> 31);
+        }
+
         virtual ~Model() {}
 
         virtual void init() {}
 
         virtual ModelFrame* frame() = 0;
         virtual bool update() = 0;
+
+        /**
+         * Applies up to `n` steps, stopping early if `update()` returns true,
+         * and returns true if it did. Models which can take several steps
+         * together more cheaply than one at a time override this.
+         */
+        virtual bool advance(int n)
+        {
+            for(int i = 0; i < n; i++)
+                if(update()) return true;
+
+            return false;
+        }
+
         virtual void render(SDL_Surface* surface, SDL_Rect* dest, const ModelFrame* frame=nullptr) = 0;
 };
 
@@ -0,0 +1,54 @@
+/** Parallel.cpp
+ *
+ *  Copyright (C) 2021 Czespo
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "Parallel.hpp"
+
+#include <thread>
+
+namespace Parallel
+{
+    int threads = 0;
+
+    int count()
+    {
+        if(threads > 0) return threads;
+
+        int hardware = std::thread::hardware_concurrency();
+        return (hardware > 0) ? hardware : 1;
+    }
+
+    Barrier::Barrier(int _count)
+        : count(_count), waiting(0), generation(0) { }
+
+    void Barrier::wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        // The last thread to arrive starts a new generation and wakes the rest.
+        unsigned long long arrived = generation;
+        if(++waiting == count)
+        {
+            waiting = 0;
+            generation++;
+            released.notify_all();
+            return;
+        }
+
+        released.wait(lock, [&]{ return generation != arrived; });
+    }
+}
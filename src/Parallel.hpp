@@ -0,0 +1,109 @@
+/** Parallel.hpp
+ *
+ *  Copyright (C) 2021 Czespo
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Parallel
+{
+    /** The number of threads to split work across. 0 means one per hardware thread. */
+    extern int threads;
+
+    /** Returns the number of threads that `for_range()` splits work across. */
+    int count();
+
+    /**
+     * Splits [begin, end) into at most `count()` contiguous chunks, and
+     * calls `f(lo, hi, chunk)` for each chunk on its own thread. Returns
+     * once every chunk is done. A range is always split the same way, so
+     * chunk `i` of one call covers the same items as chunk `i` of the next.
+     */
+    template<typename F>
+    void for_range(int begin, int end, F f)
+    {
+        int chunks = std::min(count(), end - begin);
+        if(chunks <= 1)
+        {
+            if(end > begin) f(begin, end, 0);
+            return;
+        }
+
+        std::vector<std::thread> workers;
+        for(int i = 1; i < chunks; i++)
+        {
+            int lo = begin + (long long) (end - begin) * i / chunks;
+            int hi = begin + (long long) (end - begin) * (i + 1) / chunks;
+            workers.emplace_back(f, lo, hi, i);
+        }
+
+        f(begin, begin + (int) ((long long) (end - begin) / chunks), 0);
+
+        for(std::thread& worker : workers)
+            worker.join();
+    }
+
+    /** Holds each of `count` threads in `wait()` until all of them have called it. */
+    class Barrier
+    {
+        public:
+            Barrier(int count);
+
+            void wait();
+
+        private:
+            std::mutex mutex;
+            std::condition_variable released;
+
+            int count, waiting;
+            unsigned long long generation;
+    };
+
+    /**
+     * Like `for_range()`, but calls `f(lo, hi, chunk, step)` for each step
+     * in [0, steps), and every chunk finishes a step before any chunk
+     * starts the next. The threads are started once, rather than per step.
+     */
+    template<typename F>
+    void for_steps(int begin, int end, int steps, F f)
+    {
+        int chunks = std::min(count(), end - begin);
+        if(chunks <= 1)
+        {
+            for(int step = 0; step < steps && end > begin; step++) f(begin, end, 0, step);
+            return;
+        }
+
+        Barrier barrier(chunks);
+        for_range(begin, end, [&](int lo, int hi, int chunk)
+        {
+            for(int step = 0; step < steps; step++)
+            {
+                f(lo, hi, chunk, step);
+                barrier.wait();
+            }
+        });
+    }
+}
+
+#endif // PARALLEL_HPP
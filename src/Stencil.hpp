@@ -0,0 +1,250 @@
+/** Stencil.hpp
+ *
+ *  Copyright (C) 2021 Czespo
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef STENCIL_HPP
+#define STENCIL_HPP
+
+#include "ModelCA.hpp"
+#include "Parallel.hpp"
+
+#include <algorithm>
+#include <utility>
+
+#include <cstdint>
+#include <cstdlib>
+
+/**
+ * Pieces for cellular automata in which every cell updates at once, from
+ * its own and its neighbours' states in the previous step. `StencilCA`
+ * combines a neighbourhood, a boundary and a rule into a model. All three
+ * are template parameters, so a sweep compiles down to a loop over each
+ * row with the neighbourhood unrolled and the rule inlined.
+ */
+namespace Stencil
+{
+    /** Calls `f(k)` for each k in [K, END), unrolled, so that `k` is a constant in each call. */
+    template<int K, int END>
+    struct Unroll
+    {
+        template<typename F>
+        static void each(const F& f)
+        {
+            f(K);
+            Unroll<K + 1, END>::each(f);
+        }
+    };
+
+    template<int END>
+    struct Unroll<END, END>
+    {
+        template<typename F>
+        static void each(const F&) { }
+    };
+
+    /** The four cells sharing an edge with a cell. */
+    struct VonNeumann
+    {
+        static const int RADIUS = 1, COUNT = 4;
+
+        /** Calls `f(dx, dy, k)` with the offset of each neighbour `k`. */
+        template<typename F>
+        static void each(F f)
+        {
+            f(0, -1, 0);
+            f(1, 0, 1);
+            f(0, 1, 2);
+            f(-1, 0, 3);
+        }
+    };
+
+    /** Every cell at most `R` cells away in both directions, but the cell itself. */
+    template<int R>
+    struct Radius
+    {
+        static const int RADIUS = R, COUNT = (2 * R + 1) * (2 * R + 1) - 1;
+
+        template<typename F>
+        static void each(F f)
+        {
+            // Neighbour k is cell k of the square in reading order, skipping the centre.
+            const int side = 2 * R + 1;
+            Unroll<0, COUNT>::each([&](int k)
+            {
+                int j = k + (k >= COUNT / 2);
+                f(j % side - R, j / side - R, k);
+            });
+        }
+    };
+
+    /** The eight cells sharing an edge or a corner with a cell. */
+    typedef Radius<1> Moore;
+
+    /** The grid wraps around at its edges, like a torus. */
+    struct Wrap
+    {
+        static const bool WRAPS = true;
+        static const unsigned char OUTSIDE = 0;
+    };
+
+    /** Every cell outside the grid is in state `S`. */
+    template<unsigned char S>
+    struct Fixed
+    {
+        static const bool WRAPS = false;
+        static const unsigned char OUTSIDE = S;
+    };
+
+    /** The states of a cell's neighbours, in the order the neighbourhood lists them. */
+    template<typename N>
+    struct Neighbours
+    {
+        unsigned char cells[N::COUNT];
+
+        /** Returns the number of neighbours in `state`. */
+        int count(unsigned char state) const
+        {
+            int n = 0;
+            Unroll<0, N::COUNT>::each([&](int k) { n += (cells[k] == state); });
+            return n;
+        }
+
+        /** Returns true iff any neighbour is in `state`. */
+        bool any(unsigned char state) const
+        {
+            return count(state) > 0;
+        }
+    };
+
+    /**
+     * Writes the next state of each cell in rows [from, to) of `in` to
+     * `out`, as `rule(state, neighbours, random)`. `random` is a hash of
+     * `stream` plus the cell's index, so the result doesn't depend on how
+     * the rows are split between threads. Only the cells within the radius
+     * of an edge go through the boundary; the rest are read directly.
+     */
+    template<typename N, typename B, typename Rule>
+    void sweep(const unsigned char* in, unsigned char* out, int width, int height, int from, int to,
+               const Rule& rule, std::uint64_t stream)
+    {
+        const int R = N::RADIUS;
+
+        auto at = [&](int x, int y) -> unsigned char
+        {
+            if(B::WRAPS)
+                return in[((y % height + height) % height) * width + (x % width + width) % width];
+
+            if(x < 0 || x >= width || y < 0 || y >= height) return B::OUTSIDE;
+            return in[y * width + x];
+        };
+
+        auto edge = [&](int x, int y)
+        {
+            Neighbours<N> neighbours;
+            N::each([&](int dx, int dy, int k) { neighbours.cells[k] = at(x + dx, y + dy); });
+
+            int i = y * width + x;
+            out[i] = rule(in[i], neighbours, Model::mix(stream + i));
+        };
+
+        for(int y = from; y < to; y++)
+        {
+            // The cells of this row far enough from every edge.
+            bool inner = y >= R && y < height - R;
+            int lo = (inner) ? std::min(R, width) : width;
+            int hi = (inner) ? std::max(width - R, lo) : width;
+
+            for(int x = 0; x < lo; x++) edge(x, y);
+
+            for(int x = lo; x < hi; x++)
+            {
+                const int i = y * width + x;
+
+                Neighbours<N> neighbours;
+                N::each([&](int dx, int dy, int k) { neighbours.cells[k] = in[i + dy * width + dx]; });
+
+                out[i] = rule(in[i], neighbours, Model::mix(stream + i));
+            }
+
+            for(int x = hi; x < width; x++) edge(x, y);
+        }
+    }
+}
+
+/**
+ * A cellular automaton on neighbourhood `N` with boundary `B`, whose cells
+ * all update at once by `Rule`. The next states are written to a second
+ * grid, which is then swapped in, and the rows are split across threads.
+ */
+template<typename N, typename B, typename Rule>
+class StencilCA : public ModelCA
+{
+    public:
+        StencilCA(int width, int height, const Rule& _rule)
+            : ModelCA(width, height), next(new unsigned char[width * height]{}), rule(_rule), stream(0), steps(0) { }
+
+        virtual ~StencilCA()
+        {
+            delete[] next;
+        }
+
+        bool update()
+        {
+            const std::uint64_t start = stream + steps++ * (std::uint64_t) width * height;
+            Parallel::for_range(0, height, [&](int lo, int hi, int)
+            {
+                Stencil::sweep<N, B>(cells, next, width, height, lo, hi, rule, start);
+            });
+
+            std::swap(cells, next);
+            return false;
+        }
+
+        /** Sweeps `n` steps, starting the threads once rather than once per step. */
+        bool advance(int n)
+        {
+            if(n <= 0) return false;
+
+            unsigned char* grids[2] = {cells, next};
+            const std::uint64_t first = steps;
+            Parallel::for_steps(0, height, n, [&](int lo, int hi, int, int step)
+            {
+                const std::uint64_t start = stream + (first + step) * (std::uint64_t) width * height;
+                Stencil::sweep<N, B>(grids[step % 2], grids[(step + 1) % 2], width, height, lo, hi, rule, start);
+            });
+
+            steps += n;
+            if(n % 2) std::swap(cells, next);
+            return false;
+        }
+
+    protected:
+        /** Starts a new random stream. Models should call this from `init`. */
+        void reseed()
+        {
+            stream = ((std::uint64_t) rand() << 32) ^ rand();
+            steps = 0;
+        }
+
+        unsigned char* next;
+        Rule rule;
+
+        std::uint64_t stream;
+        std::uint64_t steps;
+};
+
+#endif // STENCIL_HPP
@@ -0,0 +1,66 @@
+/** UnionFind.cpp
+ *
+ *  Copyright (C) 2021 Czespo
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "UnionFind.hpp"
+
+#include <utility>
+
+
+UnionFind::UnionFind(int count)
+{
+    reset(count);
+}
+
+void UnionFind::reset(int count)
+{
+    parent.resize(count);
+    sizes.assign(count, 1);
+
+    for(int i = 0; i < count; i++)
+        parent[i] = i;
+}
+
+int UnionFind::find(int i)
+{
+    while(parent[i] != i)
+    {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+
+    return i;
+}
+
+int UnionFind::unite(int a, int b)
+{
+    a = find(a);
+    b = find(b);
+    if(a == b) return a;
+
+    // Hang the smaller tree under the larger one.
+    if(sizes[a] < sizes[b]) std::swap(a, b);
+
+    parent[b] = a;
+    sizes[a] += sizes[b];
+    return a;
+}
+
+int UnionFind::size(int i)
+{
+    return sizes[find(i)];
+}
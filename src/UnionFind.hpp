@@ -0,0 +1,53 @@
+/** UnionFind.hpp
+ *
+ *  Copyright (C) 2021 Czespo
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef UNIONFIND_HPP
+#define UNIONFIND_HPP
+
+#include <vector>
+
+/**
+ * A disjoint-set forest over the integers [0, count), with
+ * union by size and path halving.
+ */
+class UnionFind
+{
+    public:
+        UnionFind(int count=0);
+        ~UnionFind() {}
+
+        /** Puts every integer in [0, count) into a set of its own. */
+        void reset(int count);
+
+        /** Returns the representative of the set containing `i`. */
+        int find(int i);
+
+        /**
+         * Merges the sets containing `a` and `b`, and
+         * returns the representative of the merged set.
+         */
+        int unite(int a, int b);
+
+        /** Returns the size of the set containing `i`. */
+        int size(int i);
+
+    private:
+        std::vector<int> parent, sizes;
+};
+
+#endif // UNIONFIND_HPP
@@ -73,7 +73,7 @@ void Viewer::previous()
 
 void Viewer::next()
 {
-    if(model->update())
+    if(model->advance(steps))
     {
         playing = false;
     }
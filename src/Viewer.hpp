@@ -77,6 +77,11 @@ class Viewer
                         viewer->delay = 0;
                     }
                 }
+                else if(strcmp(argv[i], "-spf") == 0)
+                {
+                    int spf = atoi(argv[i + 1]);
+                    viewer->steps = (spf > 1) ? spf : 1;
+                }
                 else if(strcmp(argv[i], "-nw") == 0)
                 {
                     viewer->no_window = true;
@@ -174,6 +179,9 @@ class Viewer
 
         int delay = 33; // ~30 FPS.
 
+        /** The number of steps the model takes between frames. */
+        int steps = 1;
+
         SDL_Rect target_rect;
 
         bool running = true;
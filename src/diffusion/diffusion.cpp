@@ -23,25 +23,59 @@
 #include "../Model2D.hpp"
 #include "../ModelCA.hpp"
 #include "../Viewer.hpp"
+#include "../Parallel.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+#include <cmath>
 #include <cstdlib>
+#include <cstring>
 #include <cstdio>
 #include <ctime>
 
+#if defined(__AVX2__) || defined(__AVX512F__) || defined(__F16C__)
+#include <immintrin.h>
+#endif
+
 
 int main(int argc, char** argv)
 {
-    // 1) Initialise model viewer.
-    if(!Viewer::Init("Diffusion model", argc, argv))
+    // -1) Quick termination if the user wants help.
+    if(argc > 1 && strcmp(argv[1], "-h") == 0)
     {
-        fprintf(stderr, "Failed to initialise model viewer!\n");
-        return 1;
+        printf("usage: diffusion [options]\n");
+        printf("-w width height (width and height of the viewer window. Default 800x600)\n");
+        printf("-f              (makes the viewer window fullscreen)\n");
+        printf("-fps fps        (frames per second of the viewer window. Default 30)\n");
+        printf("-spf steps      (the number of steps the model takes between frames. Default 1)\n");
+        printf("-s width height (width and height of the model. Default 100x100)\n");
+        printf("-r rate         (the rate at which the concentration diffuses, at most 0.25. Default 0.01, or 0.2 with -rd)\n");
+        printf("-rd feed kill   (adds a second species, reacting with the first as in the Gray-Scott model. Try 0.035 0.065)\n");
+        printf("-spectral steps (applies the exact diffusion over this many steps' worth of time in each update, with FFTs. Needs a width and height which are powers of two, and no -rd)\n");
+        printf("-storage format (stores the concentrations as fp32, bf16, fp16 or u16, a fixed-point number from 0 to 1. Default fp32)\n");
+        printf("-error steps    (runs the model for the given number of steps without a viewer, and prints the error of -storage against fp32)\n");
+        printf("-block steps    (applies up to this many steps to each cache-sized tile of the grid at a time, whenever several steps are taken at once: with -bench, -error, or -spf. Default 1)\n");
+        printf("-bench steps    (runs the model for the given number of steps without a viewer, and prints the time taken)\n");
+        printf("-scaling        (with -bench, repeats the run with 1, 2, 4... threads, up to -j, and prints the speedup of each)\n");
+        printf("-j threads      (the number of threads to use. Default one per hardware thread)\n");
+        printf("-seed seed      (the seed used for pseudo-random number generation. Default RANDOM)\n");
+        return 0;
     }
 
-    // 2) Parse command-line arguments.
+    // 1) Parse command-line arguments.
     int seed = 0;
-    int width = 9, height = 9;
-    float r = 0.01;
+    int width = 100, height = 100;
+    float r = 0.0f;
+    bool reaction = false;
+    float feed = 0.035f, kill = 0.065f;
+    int block = 1;
+    float spectral = 0.0f;
+    int storage = Diffusion::FP32;
+    int error = 0;
+    int bench = 0;
+    bool scaling = false;
     for(int i = 0; i < argc; i++)
     {
         if(strcmp(argv[i], "-s") == 0)
@@ -53,15 +87,156 @@ int main(int argc, char** argv)
         {
             r = atof(argv[i + 1]);
         }
+        else if(strcmp(argv[i], "-rd") == 0)
+        {
+            reaction = true;
+            feed = atof(argv[i + 1]);
+            kill = atof(argv[i + 2]);
+        }
+        else if(strcmp(argv[i], "-spectral") == 0)
+        {
+            spectral = atof(argv[i + 1]);
+        }
+        else if(strcmp(argv[i], "-storage") == 0)
+        {
+            const char* formats[4] = {"fp32", "bf16", "fp16", "u16"};
+            for(int f = 0; f < 4; f++)
+                if(strcmp(argv[i + 1], formats[f]) == 0) storage = f;
+        }
+        else if(strcmp(argv[i], "-error") == 0)
+        {
+            error = atoi(argv[i + 1]);
+        }
+        else if(strcmp(argv[i], "-block") == 0)
+        {
+            block = atoi(argv[i + 1]);
+        }
+        else if(strcmp(argv[i], "-bench") == 0)
+        {
+            bench = atoi(argv[i + 1]);
+        }
+        else if(strcmp(argv[i], "-scaling") == 0)
+        {
+            scaling = true;
+        }
+        else if(strcmp(argv[i], "-j") == 0)
+        {
+            Parallel::threads = atoi(argv[i + 1]);
+        }
+        else if(strcmp(argv[i], "-seed") == 0)
+        {
+            seed = atoi(argv[i + 1]);
+        }
     }
 
-    // 3) Initialise the model.
-    if(seed) srand(seed);
-    else srand(time(NULL));
+    if(r == 0.0f) r = (reaction) ? 0.2f : 0.01f;
 
-    Diffusion diffusion = Diffusion(width, height, r);
+    if(spectral != 0.0f && (reaction || !FFT::power_of_two(width) || !FFT::power_of_two(height) || width < 2))
+    {
+        fprintf(stderr, "-spectral needs a width and height which are powers of two, and no -rd!\n");
+        return 1;
+    }
 
-    // 4) Attach the model to a viewer.
+    if(spectral != 0.0f && storage != Diffusion::FP32)
+    {
+        fprintf(stderr, "-spectral needs -storage fp32!\n");
+        return 1;
+    }
+
+    // 2) Initialise the model.
+    if(seed == 0) seed = time(NULL);
+    srand(seed);
+
+    Diffusion diffusion = Diffusion(width, height, r, reaction, feed, kill, block, spectral, storage);
+
+    // 3) Without a viewer, compare the model with one stored as floats and quit.
+    if(error)
+    {
+        srand(seed);
+        Diffusion reference = Diffusion(width, height, r, reaction, feed, kill, block, spectral, Diffusion::FP32);
+
+        printf("%dx%d, error against fp32\n", width, height);
+        printf("  steps    max error    rms error%s\n", (reaction) ? "  (of U, then of V)" : "");
+        for(int checkpoint = 1, done = 0; checkpoint <= 10; checkpoint++)
+        {
+            int steps = (long long) error * checkpoint / 10 - done;
+            diffusion.advance(steps);
+            reference.advance(steps);
+            done += steps;
+
+            printf("%7d", done);
+            for(int second = 0; second <= (int) reaction; second++)
+            {
+                double most = 0.0, squares = 0.0;
+                for(int y = 0; y < height; y++)
+                {
+                    for(int x = 0; x < width; x++)
+                    {
+                        double difference = diffusion.concentration(x, y, second) - reference.concentration(x, y, second);
+                        most = std::max(most, std::abs(difference));
+                        squares += difference * difference;
+                    }
+                }
+
+                printf(" %12.3e %12.3e", most, std::sqrt(squares / ((double) width * height)));
+            }
+
+            printf("\n");
+        }
+
+        return 0;
+    }
+
+    // 4) Without a viewer, time the model and quit.
+    if(bench)
+    {
+        // Each step reads and writes every cell of each species once.
+        int bytes_per_cell = (storage == Diffusion::FP32) ? sizeof(float) : sizeof(std::uint16_t);
+        double bytes = 2.0 * ((reaction) ? 2 : 1) * bytes_per_cell * width * height * bench;
+
+        if(!scaling)
+        {
+            auto start = std::chrono::steady_clock::now();
+            diffusion.advance(bench);
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+            printf("%d steps of %dx%d in %.3f ms (%.3f ms/step, %.2f GB/s)\n", bench, width, height,
+                   elapsed.count(), elapsed.count() / bench, bytes / elapsed.count() / 1e6);
+            return 0;
+        }
+
+        // Run the same model from the same start with more and more threads.
+        int most = Parallel::count();
+        double base = 0.0;
+        printf("%d steps of %dx%d\n", bench, width, height);
+        printf("threads  ms/step     GB/s  speedup\n");
+        for(int threads = 1; ; threads = std::min(threads * 2, most))
+        {
+            Parallel::threads = threads;
+            srand(seed);
+            Diffusion model = Diffusion(width, height, r, reaction, feed, kill, block, spectral, storage);
+
+            auto start = std::chrono::steady_clock::now();
+            model.advance(bench);
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+            if(threads == 1) base = elapsed.count();
+            printf("%7d %8.3f %8.2f %8.2f\n", threads, elapsed.count() / bench, bytes / elapsed.count() / 1e6, base / elapsed.count());
+
+            if(threads == most) break;
+        }
+
+        return 0;
+    }
+
+    // 5) Initialise model viewer.
+    if(!Viewer::Init("Diffusion model", argc, argv))
+    {
+        fprintf(stderr, "Failed to initialise model viewer!\n");
+        return 1;
+    }
+
+    // 6) Attach the model to a viewer.
     Viewer::Get()->run(&diffusion);
     Viewer::Quit();
     return 0;
@@ -69,20 +244,368 @@ int main(int argc, char** argv)
 
 const SDL_Colour ModelCA::COLOURS[] = {0};
 
-Diffusion::Diffusion(int _width, int _height, float _r)
-    : Model2D(_width, _height), cells(new float[_width * _height]{}), r(_r)
+const int Diffusion::TILE;
+
+/**
+ * A row of a grid, and the rows above and below it. `west` and `east` are
+ * the row shifted by one cell each way, so that the cells on the edges can
+ * wrap around to the other side.
+ */
+struct Diffusion::Rows
+{
+    const float* up;
+    const float* row;
+    const float* down;
+    const float* west;
+    const float* east;
+};
+
+/**
+ * Diffuses cells [begin, end) of `row` at rate `r`, into `next`. The
+ * pointers are passed separately, rather than as `Rows`, so that they
+ * can be marked as not aliasing each other.
+ */
+static void diffuse(const float* __restrict up, const float* __restrict row, const float* __restrict down,
+                    const float* __restrict west, const float* __restrict east, float* __restrict next,
+                    int begin, int end, float r)
 {
-    /// TODO
+    // Each cell keeps 1 - 4r of itself, and takes r from each neighbour.
+    // Where there's FMA, keeping is fused into adding what's taken on every
+    // path, and nothing else is, so that the compiler can't contract the
+    // tail differently from the vectors and every cell rounds the same way.
+    const float keep = 1.0f - 4.0f * r;
+
+    int x = begin;
+
+#if defined(__AVX512F__)
+    const __m512 keep16 = _mm512_set1_ps(keep), rate16 = _mm512_set1_ps(r);
+    for(; x + 16 <= end; x += 16)
+    {
+        __m512 vertical = _mm512_add_ps(_mm512_loadu_ps(up + x), _mm512_loadu_ps(down + x));
+        __m512 horizontal = _mm512_add_ps(_mm512_loadu_ps(west + x), _mm512_loadu_ps(east + x));
+        __m512 sum = _mm512_mul_ps(rate16, _mm512_add_ps(vertical, horizontal));
+#if defined(__FMA__)
+        _mm512_storeu_ps(next + x, _mm512_fmadd_ps(keep16, _mm512_loadu_ps(row + x), sum));
+#else
+        _mm512_storeu_ps(next + x, _mm512_add_ps(_mm512_mul_ps(keep16, _mm512_loadu_ps(row + x)), sum));
+#endif
+    }
+#endif
+
+#if defined(__AVX2__)
+    const __m256 keep8 = _mm256_set1_ps(keep), rate8 = _mm256_set1_ps(r);
+    for(; x + 8 <= end; x += 8)
+    {
+        __m256 vertical = _mm256_add_ps(_mm256_loadu_ps(up + x), _mm256_loadu_ps(down + x));
+        __m256 horizontal = _mm256_add_ps(_mm256_loadu_ps(west + x), _mm256_loadu_ps(east + x));
+        __m256 sum = _mm256_mul_ps(rate8, _mm256_add_ps(vertical, horizontal));
+#if defined(__FMA__)
+        _mm256_storeu_ps(next + x, _mm256_fmadd_ps(keep8, _mm256_loadu_ps(row + x), sum));
+#else
+        _mm256_storeu_ps(next + x, _mm256_add_ps(_mm256_mul_ps(keep8, _mm256_loadu_ps(row + x)), sum));
+#endif
+    }
+#endif
+
+    // The remaining cells, or all of them without AVX, summed in the same order.
+    for(; x < end; x++)
+    {
+        float sum = r * ((up[x] + down[x]) + (west[x] + east[x]));
+#if defined(__FMA__)
+        next[x] = std::fma(keep, row[x], sum);
+#else
+        next[x] = keep * row[x] + sum;
+#endif
+    }
+}
+
+/**
+ * Diffuses and reacts cells [begin, end) of `u_row` and `v_row`, into
+ * `u_next` and `v_next`. The loop has no branches, so that it vectorizes.
+ */
+static void react(const float* __restrict u_up, const float* __restrict u_row, const float* __restrict u_down,
+                  const float* __restrict u_west, const float* __restrict u_east,
+                  const float* __restrict v_up, const float* __restrict v_row, const float* __restrict v_down,
+                  const float* __restrict v_west, const float* __restrict v_east,
+                  float* __restrict u_next, float* __restrict v_next,
+                  int begin, int end, float du, float dv, float feed, float kill)
+{
+    for(int x = begin; x < end; x++)
+    {
+        float a = u_row[x], b = v_row[x];
+        float u_laplacian = (u_up[x] + u_down[x]) + (u_west[x] + u_east[x]) - 4.0f * a;
+        float v_laplacian = (v_up[x] + v_down[x]) + (v_west[x] + v_east[x]) - 4.0f * b;
+
+        // U is fed in and turned into V by the reaction U + 2V -> 3V, and V is killed off.
+        float reaction = a * b * b;
+        u_next[x] = a + du * u_laplacian - reaction + feed * (1.0f - a);
+        v_next[x] = b + dv * v_laplacian + reaction - (feed + kill) * b;
+    }
+}
+
+/** Converts a float to a bfloat16, the top half of it, rounding to the nearest (or even). */
+static std::uint16_t to_bf16(float value)
+{
+    std::uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    // Keep NaNs NaN, rather than rounding them to infinity.
+    if((bits & 0x7FFFFFFF) > 0x7F800000) return (bits >> 16) | 0x40;
+
+    bits += 0x7FFF + ((bits >> 16) & 1);
+    return bits >> 16;
+}
+
+static float from_bf16(std::uint16_t half)
+{
+    std::uint32_t bits = (std::uint32_t) half << 16;
+
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/** Converts a float to an IEEE half, rounding to the nearest (or even). */
+static std::uint16_t to_fp16(float value)
+{
+    std::uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    std::uint32_t sign = bits & 0x80000000;
+    bits ^= sign;
+
+    std::uint16_t half;
+    if(bits >= (127 + 16) << 23)
+    {
+        // Too big for a half, infinite or NaN.
+        half = (bits > 0x7F800000) ? 0x7E00 : 0x7C00;
+    }
+    else if(bits < (127 - 14) << 23)
+    {
+        // Subnormal as a half. Adding 0.5 lines the half's mantissa up with
+        // the bottom of the float's, and the addition does the rounding.
+        const std::uint32_t magic_bits = (127 - 1) << 23;
+        float magic, sum;
+        std::memcpy(&magic, &magic_bits, sizeof(magic));
+        std::memcpy(&sum, &bits, sizeof(sum));
+
+        sum += magic;
+        std::uint32_t sum_bits;
+        std::memcpy(&sum_bits, &sum, sizeof(sum_bits));
+        half = sum_bits - magic_bits;
+    }
+    else
+    {
+        // Rebias the exponent, and round off the bottom 13 bits of the mantissa.
+        std::uint32_t odd = (bits >> 13) & 1;
+        bits += ((std::uint32_t) (15 - 127) << 23) + 0xFFF + odd;
+        half = bits >> 13;
+    }
+
+    return half | (sign >> 16);
+}
+
+static float from_fp16(std::uint16_t half)
+{
+    std::uint32_t exponent = half & 0x7C00;
+    std::uint32_t bits = (std::uint32_t) (half & 0x7FFF) << 13;
+
+    if(exponent == 0x7C00)
+    {
+        // Infinite or NaN.
+        bits += (255 - 31) << 23;
+    }
+    else if(exponent == 0)
+    {
+        // Zero or subnormal: make it a float with the same mantissa, and
+        // subtract the implicit one bit that that adds.
+        const std::uint32_t magic_bits = (127 - 14) << 23;
+        float magic, value;
+        bits += magic_bits;
+        std::memcpy(&magic, &magic_bits, sizeof(magic));
+        std::memcpy(&value, &bits, sizeof(value));
+
+        value -= magic;
+        std::memcpy(&bits, &value, sizeof(bits));
+    }
+    else
+    {
+        bits += (127 - 15) << 23;
+    }
+
+    bits |= (std::uint32_t) (half & 0x8000) << 16;
+
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/** Converts `n` concentrations to storage format `storage`, which isn't `FP32`. */
+static void pack(int storage, const float* in, std::uint16_t* out, int n)
+{
+    int i = 0;
+    switch(storage)
+    {
+        case Diffusion::BF16:
+            for(; i < n; i++) out[i] = to_bf16(in[i]);
+            break;
+
+        case Diffusion::FP16:
+#if defined(__F16C__)
+            for(; i + 8 <= n; i += 8)
+                _mm_storeu_si128((__m128i*) (out + i), _mm256_cvtps_ph(_mm256_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT));
+#endif
+            for(; i < n; i++) out[i] = to_fp16(in[i]);
+            break;
+
+        case Diffusion::U16:
+            for(; i < n; i++) out[i] = std::min(std::max(in[i], 0.0f), 1.0f) * 65535.0f + 0.5f;
+            break;
+    }
+}
+
+/** Converts `n` concentrations from storage format `storage`, which isn't `FP32`. */
+static void unpack(int storage, const std::uint16_t* in, float* out, int n)
+{
+    int i = 0;
+    switch(storage)
+    {
+        case Diffusion::BF16:
+            for(; i < n; i++) out[i] = from_bf16(in[i]);
+            break;
+
+        case Diffusion::FP16:
+#if defined(__F16C__)
+            for(; i + 8 <= n; i += 8)
+                _mm256_storeu_ps(out + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*) (in + i))));
+#endif
+            for(; i < n; i++) out[i] = from_fp16(in[i]);
+            break;
+
+        case Diffusion::U16:
+            for(; i < n; i++) out[i] = in[i] * (1.0f / 65535.0f);
+            break;
+    }
+}
+
+/** Copies `n` concentrations from whichever of `cells` or `cells16` is stored in, starting at `offset`. */
+static void load(int storage, const float* cells, const std::uint16_t* cells16, int offset, float* out, int n)
+{
+    if(storage == Diffusion::FP32)
+        std::memcpy(out, cells + offset, n * sizeof(float));
+    else
+        unpack(storage, cells16 + offset, out, n);
+}
+
+Diffusion::Diffusion(int _width, int _height, float _r, bool _reaction, float _feed, float _kill, int _block, float _spectral, int _storage)
+    : Model2D(_width, _height), cells(nullptr), buffer(nullptr), reagent(nullptr), reagent_buffer(nullptr),
+      cells16(nullptr), buffer16(nullptr), reagent16(nullptr), reagent_buffer16(nullptr), storage(_storage),
+      r(_r), reaction(_reaction), feed(_feed), kill(_kill), block(std::max(_block, 1)), spectral(_spectral)
+{
+    if(storage == FP32)
+    {
+        cells = allocate<float>();
+        buffer = allocate<float>();
+        if(reaction)
+        {
+            reagent = allocate<float>();
+            reagent_buffer = allocate<float>();
+        }
+    }
+    else
+    {
+        cells16 = allocate<std::uint16_t>();
+        buffer16 = allocate<std::uint16_t>();
+        if(reaction)
+        {
+            reagent16 = allocate<std::uint16_t>();
+            reagent_buffer16 = allocate<std::uint16_t>();
+        }
+    }
+
+    if(spectral != 0.0f)
+    {
+        row_fft = RealFFT(_width);
+        column_fft = FFT(_height);
+        spectrum.resize(_height * (_width / 2 + 1));
+    }
+
+    init();
 }
 
 Diffusion::~Diffusion()
 {
     delete[] cells;
+    delete[] buffer;
+    delete[] reagent;
+    delete[] reagent_buffer;
+    delete[] cells16;
+    delete[] buffer16;
+    delete[] reagent16;
+    delete[] reagent_buffer16;
+}
+
+template<typename T>
+T* Diffusion::allocate() const
+{
+    // Left uninitialised by `new`, so that no page is touched until here.
+    T* grid = new T[width * height];
+
+    // When stepped in tiles, each thread takes a band of rows of tiles
+    // rather than of rows, so the grid is touched in the same bands.
+    const int rows = (spectral == 0.0f && (storage != FP32 || block > 1)) ? TILE : 1;
+    Parallel::for_range(0, (height + rows - 1) / rows, [&](int lo, int hi, int)
+    {
+        std::fill(grid + lo * rows * width, grid + std::min(hi * rows, height) * width, T());
+    });
+
+    return grid;
+}
+
+void Diffusion::set(int i, float u, float v)
+{
+    if(storage == FP32)
+    {
+        cells[i] = u;
+        if(reaction) reagent[i] = v;
+    }
+    else
+    {
+        pack(storage, &u, cells16 + i, 1);
+        if(reaction) pack(storage, &v, reagent16 + i, 1);
+    }
+}
+
+float Diffusion::concentration(int x, int y, bool second) const
+{
+    float value;
+    if(second) load(storage, reagent, reagent16, y * width + x, &value, 1);
+    else load(storage, cells, cells16, y * width + x, &value, 1);
+    return value;
 }
 
 void Diffusion::init()
 {
-    /// TODO
+    // Initialise the model's state. //
+    for(int i = 0, end = width * height; i < end; i++)
+        set(i, (reaction) ? 1.0f : 0.0f, 0.0f);
+
+    // Drop some squares of the (second) species onto the grid.
+    int size = std::max(std::min(width, height) / 10, 1);
+    int drops = std::max(width * height / 2500, 1);
+    for(int i = 0; i < drops; i++)
+    {
+        int cx = rand() % width, cy = rand() % height;
+        for(int y = cy; y < cy + size; y++)
+        {
+            for(int x = cx; x < cx + size; x++)
+            {
+                int c = (y % height) * width + x % width;
+                if(reaction) set(c, 0.5f, 0.25f);
+                else set(c, 1.0f, 0.0f);
+            }
+        }
+    }
 }
 
 ModelFrame* Diffusion::frame()
@@ -90,26 +613,282 @@ ModelFrame* Diffusion::frame()
     return new DiffusionFrame(this);
 }
 
+Diffusion::Rows Diffusion::rows(const float* grid, int y, int begin, int end) const
+{
+    const float* row = grid + y * width;
+
+    Rows rows;
+    rows.up = grid + ((y + height - 1) % height) * width;
+    rows.row = row;
+    rows.down = grid + ((y + 1) % height) * width;
+    rows.west = (begin == 0) ? row + width - 1 : row - 1;
+    rows.east = (end == width) ? row + 1 - width : row + 1;
+    return rows;
+}
+
+void Diffusion::kernel(const Rows& u, const Rows& v, float* u_out, float* v_out, int begin, int end) const
+{
+    if(reaction)
+    {
+        react(u.up, u.row, u.down, u.west, u.east, v.up, v.row, v.down, v.west, v.east,
+              u_out, v_out, begin, end, r, r / 2, feed, kill);
+    }
+    else
+    {
+        diffuse(u.up, u.row, u.down, u.west, u.east, u_out, begin, end, r);
+    }
+}
+
+void Diffusion::step(int from, int to)
+{
+    for(int y = from; y < to; y++)
+    {
+        float* out = buffer + y * width;
+        float* reagent_out = (reaction) ? reagent_buffer + y * width : nullptr;
+
+        // The interior of the row, then its first and last cells. Each
+        // piece is given the neighbours on either side of it, so that the
+        // kernels don't need to know about the wrap.
+        const int pieces[3][2] = {{1, width - 1}, {0, 1}, {width - 1, width}};
+        for(int p = 0; p < 3; p++)
+        {
+            int begin = pieces[p][0], end = pieces[p][1];
+            if(begin >= end || (p == 2 && width == 1)) continue;
+
+            Rows v = (reaction) ? rows(reagent, y, begin, end) : Rows();
+            kernel(rows(cells, y, begin, end), v, out, reagent_out, begin, end);
+        }
+    }
+}
+
+void Diffusion::tile(int x, int y, int w, int h, int steps, Scratch& scratch)
+{
+    std::vector<float>* local = scratch.local;
+    std::vector<float>* reagent_local = scratch.reagent_local;
+
+    // The tile with its border, which may wrap around the grid.
+    const int lw = w + 2 * steps, lh = h + 2 * steps;
+    for(int i = 0; i < 2; i++)
+    {
+        local[i].resize(lw * lh);
+        if(reaction) reagent_local[i].resize(lw * lh);
+    }
+
+    for(int ly = 0; ly < lh; ly++)
+    {
+        const int gy = ((y - steps + ly) % height + height) % height;
+
+        // Copy the row in runs, starting again from the left edge of the grid whenever it wraps.
+        for(int lx = 0, gx = ((x - steps) % width + width) % width; lx < lw; gx = 0)
+        {
+            int run = std::min(lw - lx, width - gx);
+            load(storage, cells, cells16, gy * width + gx, &local[0][ly * lw + lx], run);
+            if(reaction) load(storage, reagent, reagent16, gy * width + gx, &reagent_local[0][ly * lw + lx], run);
+            lx += run;
+        }
+    }
+
+    // Each step leaves the outermost ring of what it read out of date, so
+    // step s only computes the cells at least s cells inside the border.
+    for(int s = 1; s <= steps; s++)
+    {
+        const float* u = local[(s - 1) & 1].data();
+        const float* v = (reaction) ? reagent_local[(s - 1) & 1].data() : nullptr;
+        float* u_out = local[s & 1].data();
+        float* v_out = (reaction) ? reagent_local[s & 1].data() : nullptr;
+
+        for(int ly = s; ly < lh - s; ly++)
+        {
+            Rows ur = {u + (ly - 1) * lw, u + ly * lw, u + (ly + 1) * lw, u + ly * lw - 1, u + ly * lw + 1};
+            Rows vr = Rows();
+            if(reaction) vr = {v + (ly - 1) * lw, v + ly * lw, v + (ly + 1) * lw, v + ly * lw - 1, v + ly * lw + 1};
+
+            kernel(ur, vr, u_out + ly * lw, (reaction) ? v_out + ly * lw : nullptr, s, lw - s);
+        }
+    }
+
+    // Copy the tile itself back, without its border.
+    for(int ly = 0; ly < h; ly++)
+    {
+        const int from = (ly + steps) * lw + steps, to = (y + ly) * width + x;
+        if(storage == FP32)
+        {
+            std::memcpy(buffer + to, &local[steps & 1][from], w * sizeof(float));
+            if(reaction) std::memcpy(reagent_buffer + to, &reagent_local[steps & 1][from], w * sizeof(float));
+        }
+        else
+        {
+            pack(storage, &local[steps & 1][from], buffer16 + to, w);
+            if(reaction) pack(storage, &reagent_local[steps & 1][from], reagent_buffer16 + to, w);
+        }
+    }
+}
+
+void Diffusion::blocked(int steps)
+{
+    // Each thread steps a band of rows of tiles.
+    scratch.resize(Parallel::count());
+    Parallel::for_range(0, (height + TILE - 1) / TILE, [&](int lo, int hi, int chunk)
+    {
+        for(int y = lo * TILE; y < std::min(hi * TILE, height); y += TILE)
+            for(int x = 0; x < width; x += TILE)
+                tile(x, y, std::min(TILE, width - x), std::min(TILE, height - y), steps, scratch[chunk]);
+    });
+
+    std::swap(cells, buffer);
+    std::swap(reagent, reagent_buffer);
+    std::swap(cells16, buffer16);
+    std::swap(reagent16, reagent_buffer16);
+}
+
 bool Diffusion::update()
 {
-    /// TODO
-    return true;
+    if(spectral != 0.0f)
+    {
+        propagate(spectral);
+        return false;
+    }
+
+    // Stored in 16 bits, the rows have to be converted as they're read,
+    // which the tiles already do.
+    if(storage != FP32)
+    {
+        blocked(1);
+        return false;
+    }
+
+    // Each thread computes a band of rows, reading only the rows either
+    // side of its band from its neighbours.
+    Parallel::for_range(0, height, [&](int lo, int hi, int)
+    {
+        step(lo, hi);
+    });
+
+    std::swap(cells, buffer);
+    std::swap(reagent, reagent_buffer);
+
+    return false;
+}
+
+bool Diffusion::advance(int n)
+{
+    if(spectral != 0.0f)
+    {
+        if(n > 0) propagate((double) n * spectral);
+        return false;
+    }
+
+    while(n > 0)
+    {
+        int steps = std::min(n, block);
+        if(steps == 1) update();
+        else blocked(steps);
+
+        n -= steps;
+    }
+
+    return false;
+}
+
+void Diffusion::propagate(double time)
+{
+    const int bins = width / 2 + 1;
+
+    Parallel::for_range(0, height, [&](int lo, int hi, int)
+    {
+        for(int y = lo; y < hi; y++)
+            row_fft.forward(cells + y * width, &spectrum[y * bins]);
+    });
+
+    // The eigenvalue of frequency (kx, ky) is -4 (sin^2(pi kx / W) + sin^2(pi ky / H)),
+    // so its factor splits into one for each axis. The 1 / (W H) undoes the scaling
+    // of the two inverse transforms.
+    std::vector<float> fx(bins), fy(height);
+    for(int kx = 0; kx < bins; kx++)
+    {
+        double s = std::sin(M_PI * kx / width);
+        fx[kx] = std::exp(-4.0 * r * time * s * s) / ((double) width * height);
+    }
+
+    for(int ky = 0; ky < height; ky++)
+    {
+        double s = std::sin(M_PI * ky / height);
+        fy[ky] = std::exp(-4.0 * r * time * s * s);
+    }
+
+    // Transform each column, scale it and transform it back.
+    Parallel::for_range(0, bins, [&](int lo, int hi, int)
+    {
+        std::vector<std::complex<float>> column(height);
+        for(int kx = lo; kx < hi; kx++)
+        {
+            for(int y = 0; y < height; y++)
+                column[y] = spectrum[y * bins + kx];
+
+            column_fft.forward(column.data());
+            for(int ky = 0; ky < height; ky++)
+                column[ky] *= fx[kx] * fy[ky];
+            column_fft.inverse(column.data());
+
+            for(int y = 0; y < height; y++)
+                spectrum[y * bins + kx] = column[y];
+        }
+    });
+
+    Parallel::for_range(0, height, [&](int lo, int hi, int)
+    {
+        for(int y = lo; y < hi; y++)
+            row_fft.inverse(&spectrum[y * bins], cells + y * width);
+    });
 }
 
 void Diffusion::render(SDL_Surface* surface, SDL_Rect* dest, const ModelFrame* frame)
 {
-    /// TODO
+    const DiffusionFrame* _frame = (const DiffusionFrame*) frame;
+    const float* _cells = (frame != nullptr) ? _frame->cells : this->cells;
+    const std::uint16_t* _cells16 = (frame != nullptr) ? _frame->cells16 : this->cells16;
+
+    std::vector<float> row(width);
+
+    int cellSize = std::min(dest->w / width, dest->h / height);
+    int xp = (dest->w - cellSize * width) / 2;
+    int yp = (dest->h - cellSize * height) / 2;
+
+    for(int y = 0; y < height; y++)
+    {
+        load(storage, _cells, _cells16, y * width, row.data(), width);
+        for(int x = 0; x < width; x++)
+        {
+            // Shade each cell from black to pale blue by its concentration.
+            float value = std::min(std::max(row[x], 0.0f), 1.0f);
+            int level = (int) (value * 255.0f);
+
+            SDL_Rect r = {x * cellSize + xp + dest->x, y * cellSize + yp + dest->y, cellSize, cellSize};
+            SDL_FillRect(surface, &r, SDL_MapRGB(surface->format, level * 3 / 4, level * 7 / 8, level));
+        }
+    }
 }
 
 // D I F F U S I O N  F R A M E //
 // ============================ //
 
-DiffusionFrame::DiffusionFrame(const Diffusion* model) : cells(new float[model->width * model->height])
+DiffusionFrame::DiffusionFrame(const Diffusion* model) : cells(nullptr), cells16(nullptr), storage(model->storage)
 {
-    std::memcpy(cells, model->cells, model->width * model->height * sizeof(float));
+    // Frames are kept in the model's own format, so they're half the size in 16 bits.
+    if(storage == Diffusion::FP32)
+    {
+        cells = new float[model->width * model->height];
+        std::memcpy(cells, model->cells, model->width * model->height * sizeof(float));
+    }
+    else
+    {
+        cells16 = new std::uint16_t[model->width * model->height];
+        std::memcpy(cells16, model->cells16, model->width * model->height * sizeof(std::uint16_t));
+    }
 }
 
 DiffusionFrame::~DiffusionFrame()
 {
     delete[] cells;
+    delete[] cells16;
 }
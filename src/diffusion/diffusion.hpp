@@ -22,6 +22,12 @@
 #define DIFFUSION_HPP
 
 #include "../Model2D.hpp"
+#include "fft.hpp"
+
+#include <complex>
+#include <vector>
+
+#include <cstdint>
 
 class Diffusion;
 
@@ -30,13 +36,42 @@ struct DiffusionFrame : public ModelFrame
     DiffusionFrame(const Diffusion* model);
     ~DiffusionFrame();
 
+    /** The concentrations, in whichever of these the model stores them in. */
     float* cells;
+    std::uint16_t* cells16;
+    int storage;
 };
 
 class Diffusion : public Model2D
 {
     public:
-        Diffusion(int width, int height, float r);
+        /**
+         * The formats the concentrations can be stored in between steps.
+         * They're always computed as 32-bit floats. `U16` is fixed-point,
+         * holding concentrations from 0 to 1 in steps of 1/65535.
+         */
+        static const int FP32 = 0,
+                         BF16 = 1,
+                         FP16 = 2,
+                         U16 = 3;
+
+        /**
+         * Diffuses a concentration over the grid at rate `r`, which must be
+         * at most 0.25 for the model to be stable. If `reaction` is true,
+         * a second species is added and the two react as in the Gray-Scott
+         * model, with the second diffusing at half the rate of the first.
+         * `advance` applies up to `block` steps to each tile at a time.
+         *
+         * If `spectral` isn't 0, each update instead applies the exact
+         * solution for `spectral` steps' worth of time at once, in Fourier
+         * space, which is stable for any `r`. The width and height must
+         * then be powers of two, and the species can't react.
+         *
+         * Any `storage` but `FP32` halves the memory each step streams
+         * through, and is always stepped in tiles. It can't be spectral.
+         */
+        Diffusion(int width, int height, float r, bool reaction=false, float feed=0.035f, float kill=0.065f,
+                  int block=1, float spectral=0.0f, int storage=FP32);
         ~Diffusion();
 
         void init();
@@ -45,11 +80,100 @@ class Diffusion : public Model2D
         bool update();
         void render(SDL_Surface* surface, SDL_Rect* dest, const ModelFrame* frame);
 
+        /**
+         * Applies `n` steps. Rather than sweeping the whole grid once per
+         * step, the grid is split into tiles small enough to stay in cache,
+         * and each tile is copied out with a border `block` cells wide and
+         * stepped `block` times before the next tile is started. The border
+         * shrinks by a cell each step, leaving the tile exact at the end.
+         * In spectral mode, all `n` steps are applied in one transform.
+         */
+        bool advance(int n);
+
+        /** Returns the concentration of the first (or second) species in cell (x, y). */
+        float concentration(int x, int y, bool second=false) const;
+
     private:
+        /** The rows of a grid around one row, for the kernels. */
+        struct Rows;
+
+        /** Returns the rows around row `y` of `grid`, for cells [begin, end), wrapping around the edges. */
+        Rows rows(const float* grid, int y, int begin, int end) const;
+
+        /** Computes cells [begin, end) of a row of the next step, given the rows around it in each species. */
+        void kernel(const Rows& u, const Rows& v, float* u_out, float* v_out, int begin, int end) const;
+
+        /** Computes rows [from, to) of the next step into the buffers. `update` splits the rows across threads. */
+        void step(int from, int to);
+
+        /** The current tile and its border, and the buffer for its next step, of each species. */
+        struct Scratch
+        {
+            std::vector<float> local[2], reagent_local[2];
+        };
+
+        /** Applies `steps` steps to the `w` by `h` tile at (x, y), writing it to the buffers. */
+        void tile(int x, int y, int w, int h, int steps, Scratch& scratch);
+
+        /** Applies `steps` steps to every tile, and swaps in the buffers. */
+        void blocked(int steps);
+
+        /** Sets the concentrations of cell `i`. */
+        void set(int i, float u, float v);
+
+        /**
+         * Diffuses the concentration for `time` steps' worth of time. The
+         * grid is transformed, each frequency is scaled by e^(r time l), where
+         * l is its eigenvalue of the 5-point Laplacian, and it's transformed back.
+         */
+        void propagate(double time);
+
+        /**
+         * Returns a zeroed grid, each band of rows (or of rows of tiles,
+         * if it's stepped in tiles) of which is first written by the thread
+         * which steps it, so that on a NUMA machine its pages are placed
+         * in that thread's memory.
+         */
+        template<typename T>
+        T* allocate() const;
+
+        /**
+         * The concentration of the first species, and the buffer its next
+         * step is written to, if they're stored as floats.
+         */
         float* cells;
+        float* buffer;
+
+        /** The same for the second species, if the species react. */
+        float* reagent;
+        float* reagent_buffer;
+
+        /** The same four grids, if they're stored in 16 bits. */
+        std::uint16_t* cells16;
+        std::uint16_t* buffer16;
+        std::uint16_t* reagent16;
+        std::uint16_t* reagent_buffer16;
+
+        int storage;
 
         float r;
 
+        bool reaction;
+        float feed, kill;
+
+        int block;
+        static const int TILE = 256;
+
+        /** One for each thread. */
+        std::vector<Scratch> scratch;
+
+        float spectral;
+        RealFFT row_fft;
+        FFT column_fft;
+
+        /** The non-negative frequencies of each row, during `propagate`. */
+        std::vector<std::complex<float>> spectrum;
+
     friend DiffusionFrame::DiffusionFrame(const Diffusion*);
 };
 
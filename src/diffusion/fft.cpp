@@ -0,0 +1,167 @@
+/** fft.cpp
+ *
+ *  Copyright (C) 2021 Czespo
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "fft.hpp"
+
+#include <utility>
+
+#include <cmath>
+
+
+FFT::FFT(int _n) : n(_n), reversed(_n), twiddles(_n / 2)
+{
+    int bits = 0;
+    while((1 << bits) < n) bits++;
+
+    for(int i = 0; i < n; i++)
+    {
+        int r = 0;
+        for(int b = 0; b < bits; b++)
+            if(i & (1 << b)) r |= 1 << (bits - 1 - b);
+
+        reversed[i] = r;
+    }
+
+    // The twiddles are worked out in double precision, so that the
+    // error of each is within half a float ulp, whatever `n` is.
+    for(int k = 0; k < n / 2; k++)
+    {
+        double angle = -2.0 * M_PI * k / n;
+        twiddles[k] = std::complex<float>(std::cos(angle), std::sin(angle));
+    }
+}
+
+bool FFT::power_of_two(int n)
+{
+    return n > 0 && (n & (n - 1)) == 0;
+}
+
+int FFT::size() const
+{
+    return n;
+}
+
+void FFT::forward(std::complex<float>* data) const
+{
+    transform(data, false);
+}
+
+void FFT::inverse(std::complex<float>* data) const
+{
+    transform(data, true);
+}
+
+void FFT::transform(std::complex<float>* data, bool inverse) const
+{
+    for(int i = 0; i < n; i++)
+        if(i < reversed[i]) std::swap(data[i], data[reversed[i]]);
+
+    // Combine pairs of transforms of length `half` into transforms of twice the length.
+    for(int half = 1; half < n; half *= 2)
+    {
+        const int stride = n / (2 * half);
+        for(int start = 0; start < n; start += 2 * half)
+        {
+            for(int k = 0; k < half; k++)
+            {
+                std::complex<float> w = twiddles[k * stride];
+                if(inverse) w = std::conj(w);
+
+                std::complex<float> even = data[start + k];
+                std::complex<float> odd = w * data[start + k + half];
+                data[start + k] = even + odd;
+                data[start + k + half] = even - odd;
+            }
+        }
+    }
+}
+
+RealFFT::RealFFT(int _n) : n(_n), half(_n / 2), twiddles(_n / 2 + 1)
+{
+    for(int k = 0; k <= n / 2; k++)
+    {
+        double angle = -2.0 * M_PI * k / n;
+        twiddles[k] = std::complex<float>(std::cos(angle), std::sin(angle));
+    }
+}
+
+void RealFFT::forward(const float* in, std::complex<float>* out) const
+{
+    const int m = n / 2;
+
+    // Transform z[j] = in[2j] + i in[2j + 1].
+    for(int j = 0; j < m; j++)
+        out[j] = std::complex<float>(in[2 * j], in[2 * j + 1]);
+
+    half.forward(out);
+
+    // The transforms of the even and odd samples are E[k] = (Z[k] + Z*[m - k]) / 2
+    // and O[k] = (Z[k] - Z*[m - k]) / 2i, and X[k] = E[k] + e^(-2 pi i k / n) O[k].
+    // Frequencies k and m - k are worked out together, as each needs the other.
+    const std::complex<float> i(0.0f, 1.0f);
+    for(int k = 1; k <= m / 2; k++)
+    {
+        std::complex<float> a = out[k], b = std::conj(out[m - k]);
+
+        std::complex<float> even = 0.5f * (a + b);
+        std::complex<float> odd = -0.5f * i * (a - b);
+        std::complex<float> even_mirror = std::conj(even);
+        std::complex<float> odd_mirror = std::conj(odd);
+
+        out[k] = even + twiddles[k] * odd;
+        out[m - k] = even_mirror + twiddles[m - k] * odd_mirror;
+    }
+
+    // Z[0] packs the sum of the even and of the odd samples.
+    std::complex<float> z = out[0];
+    out[0] = z.real() + z.imag();
+    out[m] = z.real() - z.imag();
+}
+
+void RealFFT::inverse(std::complex<float>* in, float* out) const
+{
+    const int m = n / 2;
+
+    // Undo the untangling: 2E[k] = X[k] + X*[m - k] and
+    // 2O[k] = (X[k] - X*[m - k]) e^(2 pi i k / n), and Z[k] = E[k] + i O[k].
+    // The factor of 2 is kept, to make the result n (rather than m) times the input.
+    const std::complex<float> i(0.0f, 1.0f);
+    std::complex<float> first(in[0].real() + in[m].real(), in[0].real() - in[m].real());
+    for(int k = 1; k <= m / 2; k++)
+    {
+        std::complex<float> a = in[k], b = std::conj(in[m - k]);
+
+        std::complex<float> even = a + b;
+        std::complex<float> odd = (a - b) * std::conj(twiddles[k]);
+        std::complex<float> even_mirror = std::conj(even);
+        std::complex<float> odd_mirror = std::conj(odd);
+
+        in[k] = even + i * odd;
+        in[m - k] = even_mirror + i * odd_mirror;
+    }
+
+    in[0] = first;
+
+    half.inverse(in);
+
+    for(int j = 0; j < m; j++)
+    {
+        out[2 * j] = in[j].real();
+        out[2 * j + 1] = in[j].imag();
+    }
+}
@@ -0,0 +1,88 @@
+/** fft.hpp
+ *
+ *  Copyright (C) 2021 Czespo
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef FFT_HPP
+#define FFT_HPP
+
+#include <complex>
+#include <vector>
+
+/**
+ * A fast Fourier transform of complex sequences whose length is a
+ * power of two, using the iterative radix-2 Cooley-Tukey algorithm.
+ */
+class FFT
+{
+    public:
+        /** `n` must be a power of two. */
+        FFT(int n=1);
+        ~FFT() {}
+
+        static bool power_of_two(int n);
+
+        int size() const;
+
+        /**
+         * Transforms `data` in place. The inverse isn't scaled, so
+         * transforming forward then back multiplies `data` by `n`.
+         */
+        void forward(std::complex<float>* data) const;
+        void inverse(std::complex<float>* data) const;
+
+    private:
+        void transform(std::complex<float>* data, bool inverse) const;
+
+        int n;
+
+        /** The index that each index is swapped with before the first pass. */
+        std::vector<int> reversed;
+
+        /** e^(-2 pi i k / n), for k in [0, n / 2). */
+        std::vector<std::complex<float>> twiddles;
+};
+
+/**
+ * A fast Fourier transform of real sequences whose length `n` is a
+ * power of two, at least 2. The even and odd samples are packed into
+ * a complex sequence of half the length, which is transformed, and
+ * the two halves of the result are then untangled.
+ */
+class RealFFT
+{
+    public:
+        RealFFT(int n=2);
+        ~RealFFT() {}
+
+        /** Writes the `n / 2 + 1` non-negative frequencies of `in` to `out`. */
+        void forward(const float* in, std::complex<float>* out) const;
+
+        /**
+         * The inverse of `forward`, unscaled like `FFT::inverse`. `in`
+         * holds `n / 2 + 1` frequencies, and is overwritten.
+         */
+        void inverse(std::complex<float>* in, float* out) const;
+
+    private:
+        int n;
+        FFT half;
+
+        /** e^(-2 pi i k / n), for k in [0, n / 2]. */
+        std::vector<std::complex<float>> twiddles;
+};
+
+#endif // FFT_HPP
@@ -24,7 +24,7 @@
 #include "../Viewer.hpp"
 #include "../Args.hpp"
 
-#include <vector>
+#include <algorithm>
 
 #include <cstdlib>
 #include <cstdio>
@@ -40,6 +40,7 @@ int main(int argc, char** argv)
         printf("-w width height (width and height of the viewer window. Default 800x600)\n");
         printf("-f              (makes the viewer window fullscreen)\n");
         printf("-fps fps        (frames per second of the viewer window. Default 30)\n");
+        printf("-spf steps      (the number of steps the model takes between frames. Default 1)\n");
         printf("-s width height (width and height of the model. Default 50x50)\n");
         printf("-p prob         (the probability that an empty cell becomes a tree. Default 0.01)\n");
         printf("-f prob         (the probability that a tree catches fire. Default 0.001)\n");
@@ -101,7 +102,13 @@ const SDL_Colour ModelCA::COLOURS[3] = {
     {255, 96, 96, 255}
 };
 
-ForestFire::ForestFire(int _width, int _height, float _p, float _f) : ModelCA(_width, _height), p(_p), f(_f)
+const unsigned char ForestFireRule::EMPTY, ForestFireRule::TREE, ForestFireRule::FIRE;
+
+ForestFireRule::ForestFireRule(float p, float f)
+    : grow(std::min(std::max(p, 0.0f), 1.0f) * 4294967296.0), ignite(std::min(std::max(f, 0.0f), 1.0f) * 4294967296.0) { }
+
+ForestFire::ForestFire(int _width, int _height, float _p, float _f)
+    : StencilCA(_width, _height, ForestFireRule(_p, _f)), p(_p), f(_f)
 {
     init();
 }
@@ -112,51 +119,6 @@ void ForestFire::init()
     unsigned char choices[2] = {EMPTY, TREE};
     float weights[2] = {1.0f - p, p};
     init_cells(2, choices, weights);
-}
-
-bool ForestFire::update()
-{
-    std::vector<std::pair<int, int>> burning;
-    for(int y = 0; y < height; y++)
-    {
-        for(int x = 0; x < width; x++)
-        {
-            if(cell(x, y) == EMPTY)
-            {
-                // This cell becomes a tree with probability p.
-                if((float) rand() / RAND_MAX < p)
-                    cell(x, y) = TREE;
-            }
-
-            if(cell(x, y) == TREE)
-            {
-                // This cell catches fire spontaneously with probability f.
-                if((float) rand() / RAND_MAX < f)
-                    burning.push_back(std::pair<int, int>(x, y));
-            }
-            else if(cell(x, y) == FIRE)
-            {
-                // If any trees neighbour this cell, set them on fire.
-                if(!outOfBounds(x, y - 1) && cell(x, y - 1) == TREE)
-                    burning.push_back(std::pair<int, int>(x, y - 1));
-
-                if(!outOfBounds(x + 1, y) && cell(x + 1, y) == TREE)
-                    burning.push_back(std::pair<int, int>(x + 1, y));
-
-                if(!outOfBounds(x, y + 1) && cell(x, y + 1) == TREE)
-                    burning.push_back(std::pair<int, int>(x, y + 1));
-
-                if(!outOfBounds(x - 1, y) && cell(x - 1, y) == TREE)
-                    burning.push_back(std::pair<int, int>(x - 1, y));
-
-                // Put this fire out.
-                cell(x, y) = EMPTY;
-            }
-        }
-    }
-
-    for(auto p : burning)
-        cell(p.first, p.second) = FIRE;
 
-    return false;
+    reseed();
 }
@@ -21,21 +21,58 @@
 #ifndef FORESTFIRE_HPP
 #define FORESTFIRE_HPP
 
-#include "../ModelCA.hpp"
+#include "../Stencil.hpp"
 
-class ForestFire : public ModelCA
+#include <cstdint>
+
+/**
+ * Each step, fires burn out, trees next to a fire catch fire, and
+ * otherwise trees catch fire with probability f and empty cells grow
+ * a tree with probability p. A tree which has just grown can be struck
+ * by lightning in the same step, as in the original in-place update.
+ * The update is synchronous, though, so a new tree only catches fire
+ * from its neighbours in the next step; in place, that depended on
+ * whether the fire was scanned before or after the tree.
+ */
+struct ForestFireRule
+{
+    static const unsigned char EMPTY = 0,
+                               TREE = 1,
+                               FIRE = 2;
+
+    ForestFireRule(float p, float f);
+
+    unsigned char operator()(unsigned char state, const Stencil::Neighbours<Stencil::VonNeumann>& neighbours, std::uint64_t random) const
+    {
+        if(state == FIRE) return EMPTY;
+
+        // The low half of `random` decides growth, and the high half lightning.
+        bool struck = (random >> 32) < ignite;
+        if(state == EMPTY)
+        {
+            if((random & 0xFFFFFFFF) >= grow) return EMPTY;
+            return (struck) ? FIRE : TREE;
+        }
+
+        return (neighbours.any(FIRE) || struck) ? FIRE : TREE;
+    }
+
+    /** The probabilities, out of 2^32. */
+    std::uint64_t grow, ignite;
+};
+
+class ForestFire : public StencilCA<Stencil::VonNeumann, Stencil::Fixed<ForestFireRule::EMPTY>, ForestFireRule>
 {
     public:
         ForestFire(int _width, int _height, float _p, float _f);
         ~ForestFire() {}
 
         void init();
-        bool update();
 
     private:
-        const unsigned char EMPTY = 0,
-                            TREE = 1,
-                            FIRE = 2;
+        const unsigned char EMPTY = ForestFireRule::EMPTY,
+                            TREE = ForestFireRule::TREE,
+                            FIRE = ForestFireRule::FIRE;
 
         float p, f;
 };
@@ -0,0 +1,260 @@
+
+/** hashlife.cpp, based on
+ *  'An algorithm for compressing space and time' Gosper (1984)
+ *
+ *  Copyright (C) 2021 Czespo
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "hashlife.hpp"
+
+#include "../Model.hpp"
+
+#include <algorithm>
+
+HashLife::HashLife(const LifeRule& rule)
+{
+    for(int s = 0; s < 2; s++)
+        for(int n = 0; n <= 8; n++)
+            next[s][n] = rule.table[s * 9 + n] == LifeRule::ALIVE;
+
+    for(int s = 0; s < 2; s++)
+    {
+        store.push_back(Node{nullptr, nullptr, nullptr, nullptr, 0, (std::uint64_t) s, nullptr, -1});
+        leaves[s] = &store.back();
+    }
+
+    empties.push_back(leaves[0]);
+
+    load({});
+}
+
+bool HashLife::supports(const LifeRule& rule)
+{
+    return rule.states == 2 && rule.table[LifeRule::DEAD * 9] == LifeRule::DEAD;
+}
+
+std::size_t HashLife::Hash::operator()(const std::array<Node*, 4>& key) const
+{
+    std::uint64_t h = 0;
+    for(Node* node : key) h = Model::mix(h ^ (std::uint64_t) (std::uintptr_t) node);
+    return h;
+}
+
+HashLife::Node* HashLife::join(Node* nw, Node* ne, Node* sw, Node* se)
+{
+    std::array<Node*, 4> key = {nw, ne, sw, se};
+
+    auto found = table.find(key);
+    if(found != table.end()) return found->second;
+
+    store.push_back(Node{nw, ne, sw, se, nw->level + 1,
+                         nw->population + ne->population + sw->population + se->population, nullptr, -1});
+    table.emplace(key, &store.back());
+    return &store.back();
+}
+
+HashLife::Node* HashLife::empty(int level)
+{
+    while((int) empties.size() <= level)
+    {
+        Node* e = empties.back();
+        empties.push_back(join(e, e, e, e));
+    }
+
+    return empties[level];
+}
+
+HashLife::Node* HashLife::centre(Node* node)
+{
+    return join(node->nw->se, node->ne->sw, node->sw->ne, node->se->nw);
+}
+
+void HashLife::expand()
+{
+    int level = root->level;
+    Node* e = empty(level - 1);
+
+    root = join(join(e, e, e, root->nw), join(e, e, root->ne, e),
+                join(e, root->sw, e, e), join(root->se, e, e, e));
+
+    left -= 1LL << (level - 1);
+    top -= 1LL << (level - 1);
+}
+
+HashLife::Node* HashLife::set(Node* node, long long x, long long y)
+{
+    if(node->level == 0) return leaves[1];
+
+    long long half = 1LL << (node->level - 1);
+    bool east = x >= half, south = y >= half;
+    if(east) x -= half;
+    if(south) y -= half;
+
+    if(south) return (east) ? join(node->nw, node->ne, node->sw, set(node->se, x, y))
+                            : join(node->nw, node->ne, set(node->sw, x, y), node->se);
+    else      return (east) ? join(node->nw, set(node->ne, x, y), node->sw, node->se)
+                            : join(set(node->nw, x, y), node->ne, node->sw, node->se);
+}
+
+void HashLife::load(const std::vector<std::pair<long long, long long>>& cells)
+{
+    left = top = 0;
+    long long right = 0, bottom = 0;
+    if(!cells.empty())
+    {
+        left = right = cells[0].first;
+        top = bottom = cells[0].second;
+        for(const auto& cell : cells)
+        {
+            left = std::min(left, cell.first);
+            right = std::max(right, cell.first);
+            top = std::min(top, cell.second);
+            bottom = std::max(bottom, cell.second);
+        }
+    }
+
+    int level = 3;
+    while((1LL << level) <= std::max(right - left, bottom - top)) level++;
+
+    root = empty(level);
+    for(const auto& cell : cells) root = set(root, cell.first - left, cell.second - top);
+
+    elapsed = 0;
+}
+
+HashLife::Node* HashLife::base(Node* node)
+{
+    // Unpack the 4x4 cells, then count the neighbours of the middle four.
+    int c[4][4];
+    Node* quadrants[4] = {node->nw, node->ne, node->sw, node->se};
+    for(int q = 0; q < 4; q++)
+    {
+        Node* cells[4] = {quadrants[q]->nw, quadrants[q]->ne, quadrants[q]->sw, quadrants[q]->se};
+        for(int i = 0; i < 4; i++)
+            c[(q / 2) * 2 + i / 2][(q % 2) * 2 + i % 2] = (int) cells[i]->population;
+    }
+
+    Node* out[4];
+    for(int i = 0; i < 4; i++)
+    {
+        int y = 1 + i / 2, x = 1 + i % 2;
+        int n = c[y - 1][x - 1] + c[y - 1][x] + c[y - 1][x + 1]
+              + c[y][x - 1]                   + c[y][x + 1]
+              + c[y + 1][x - 1] + c[y + 1][x] + c[y + 1][x + 1];
+
+        out[i] = leaves[next[c[y][x]][n]];
+    }
+
+    return join(out[0], out[1], out[2], out[3]);
+}
+
+HashLife::Node* HashLife::successor(Node* node, int step)
+{
+    if(node->population == 0) return empty(node->level - 1);
+    if(node->step == step) return node->result;
+
+    Node* result;
+    if(node->level == 2)
+    {
+        result = base(node);
+    }
+    else
+    {
+        // The nine overlapping squares of half the size, three by three.
+        Node* n[9] = {
+            node->nw, join(node->nw->ne, node->ne->nw, node->nw->se, node->ne->sw), node->ne,
+            join(node->nw->sw, node->nw->se, node->sw->nw, node->sw->ne), centre(node),
+            join(node->ne->sw, node->ne->se, node->se->nw, node->se->ne),
+            node->sw, join(node->sw->ne, node->se->nw, node->sw->se, node->se->sw), node->se
+        };
+
+        // At the largest step, each half of the jump is taken by one of the
+        // two rounds of successors. Otherwise, the first round only crops,
+        // and the whole jump is taken by the second.
+        bool full = step == node->level - 2;
+
+        Node* a[9];
+        for(int i = 0; i < 9; i++)
+            a[i] = (full) ? successor(n[i], step - 1) : centre(n[i]);
+
+        int inner = (full) ? step - 1 : step;
+        result = join(successor(join(a[0], a[1], a[3], a[4]), inner),
+                      successor(join(a[1], a[2], a[4], a[5]), inner),
+                      successor(join(a[3], a[4], a[6], a[7]), inner),
+                      successor(join(a[4], a[5], a[7], a[8]), inner));
+    }
+
+    node->result = result;
+    node->step = step;
+    return result;
+}
+
+void HashLife::advance(std::uint64_t generations)
+{
+    for(int k = 0; k < 64 && (generations >> k) != 0; k++)
+    {
+        if(((generations >> k) & 1) == 0) continue;
+
+        // Cells move at most one cell a generation, so if the pattern fits
+        // in the middle quarter of the root, and the jump is at most an
+        // eighth of its size, nothing can leave the half that's kept.
+        while(root->level < k + 3 || centre(centre(root))->population != root->population) expand();
+
+        long long quarter = 1LL << (root->level - 2);
+        root = successor(root, k);
+        left += quarter;
+        top += quarter;
+
+        elapsed += 1ULL << k;
+    }
+}
+
+std::uint64_t HashLife::generation() const
+{
+    return elapsed;
+}
+
+std::uint64_t HashLife::population() const
+{
+    return root->population;
+}
+
+std::size_t HashLife::nodes() const
+{
+    return store.size();
+}
+
+void HashLife::cells(std::vector<std::pair<long long, long long>>& out) const
+{
+    collect(root, left, top, out);
+}
+
+void HashLife::collect(const Node* node, long long x, long long y, std::vector<std::pair<long long, long long>>& out) const
+{
+    if(node->population == 0) return;
+
+    if(node->level == 0)
+    {
+        out.emplace_back(x, y);
+        return;
+    }
+
+    long long half = 1LL << (node->level - 1);
+    collect(node->nw, x, y, out);
+    collect(node->ne, x + half, y, out);
+    collect(node->sw, x, y + half, out);
+    collect(node->se, x + half, y + half, out);
+}
@@ -0,0 +1,133 @@
+
+/** hashlife.hpp, based on
+ *  'An algorithm for compressing space and time' Gosper (1984)
+ *
+ *  Copyright (C) 2021 Czespo
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef HASHLIFE_HPP
+#define HASHLIFE_HPP
+
+#include "life.hpp"
+
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * Runs a two-state Life-like rule on an unbounded plane with Gosper's
+ * HashLife. The plane is a quadtree whose nodes are shared: each distinct
+ * square of cells is stored once, however often it appears, in space or
+ * in time. Each node remembers what its centre becomes some power of two
+ * generations later, so a pattern which repeats itself is only worked out
+ * once, and for such patterns a jump of 2^k generations often costs little
+ * more than one of 2^(k-1).
+ */
+class HashLife
+{
+    public:
+        /**
+         * `rule` must have two states, and mustn't give birth to cells with
+         * no live neighbours, as the empty plane around the pattern must
+         * stay empty. See `supports()`.
+         */
+        HashLife(const LifeRule& rule);
+        ~HashLife() {}
+
+        static bool supports(const LifeRule& rule);
+
+        /** Replaces the pattern with the given live cells. */
+        void load(const std::vector<std::pair<long long, long long>>& cells);
+
+        /** Advances the pattern by `generations`, in jumps of powers of two. */
+        void advance(std::uint64_t generations);
+
+        /** Returns the number of generations since the pattern was loaded. */
+        std::uint64_t generation() const;
+
+        std::uint64_t population() const;
+
+        /** Returns the number of distinct nodes made so far. */
+        std::size_t nodes() const;
+
+        /** Appends the live cells of the pattern to `out`. */
+        void cells(std::vector<std::pair<long long, long long>>& out) const;
+
+    private:
+        /**
+         * A square of 2^level cells a side. A leaf (level 0) is a single cell;
+         * any other node is made of four quadrants one level down.
+         */
+        struct Node
+        {
+            Node* nw, *ne, *sw, *se;
+            int level;
+            std::uint64_t population;
+
+            /** The centre of the node after 2^`step` generations, if `step` isn't -1. */
+            Node* result;
+            int step;
+        };
+
+        struct Hash
+        {
+            std::size_t operator()(const std::array<Node*, 4>& key) const;
+        };
+
+        /** Returns the node made of the given quadrants, making it if it doesn't exist. */
+        Node* join(Node* nw, Node* ne, Node* sw, Node* se);
+
+        Node* empty(int level);
+
+        /** Returns the square half as wide as `node` at its centre. */
+        Node* centre(Node* node);
+
+        /** Surrounds `root` with empty space, doubling its size. */
+        void expand();
+
+        /** Returns `node` with the cell at (x, y) within it set alive. */
+        Node* set(Node* node, long long x, long long y);
+
+        /**
+         * Returns the centre of `node` (which is half its size) after
+         * 2^`step` generations. `step` is at most `node->level - 2`.
+         */
+        Node* successor(Node* node, int step);
+
+        /** Works out the centre of a node of 4x4 cells after one generation. */
+        Node* base(Node* node);
+
+        void collect(const Node* node, long long x, long long y, std::vector<std::pair<long long, long long>>& out) const;
+
+        /** Whether a dead (0) or live (1) cell with `n` live neighbours is alive next generation. */
+        bool next[2][9];
+
+        std::deque<Node> store;
+        std::unordered_map<std::array<Node*, 4>, Node*, Hash> table;
+        Node* leaves[2];
+        std::vector<Node*> empties;
+
+        /** The whole pattern, and the position of its top left corner on the plane. */
+        Node* root;
+        long long left, top;
+
+        std::uint64_t elapsed;
+};
+
+#endif // HASHLIFE_HPP
@@ -0,0 +1,409 @@
+/** life.cpp, based on
+ *  'Mathematical Games: The fantastic combinations of John Conway's new
+ *  solitaire game "life"' Martin Gardner (1970)
+ *
+ *  Copyright (C) 2021 Czespo
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "life.hpp"
+#include "hashlife.hpp"
+
+#include "../ModelCA.hpp"
+#include "../Viewer.hpp"
+#include "../Parallel.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <ctime>
+
+
+int main(int argc, char** argv)
+{
+    // -1) Quick termination if the user wants help.
+    if(argc > 1 && strcmp(argv[1], "-h") == 0)
+    {
+        printf("usage: life [options]\n");
+        printf("-w width height (width and height of the viewer window. Default 800x600)\n");
+        printf("-f              (makes the viewer window fullscreen)\n");
+        printf("-fps fps        (frames per second of the viewer window. Default 30)\n");
+        printf("-spf steps      (the number of steps the model takes between frames. Default 1)\n");
+        printf("-s width height (width and height of the model, which wraps around at its edges. Default 100x100)\n");
+        printf("-rule rule      (the rule, as B3/S23, B2/S/C3 for Generations rules with more than two states, or S/B as 23/3. Default B3/S23)\n");
+        printf("-d density      (the proportion of cells which start alive. Default 0.3)\n");
+        printf("-pattern file   (starts from the pattern in an RLE file, using its rule unless -rule is given)\n");
+        printf("-bench steps    (runs the model for the given number of steps without a viewer, and prints the time taken)\n");
+        printf("-hashlife gens  (runs the model for the given number of generations with HashLife, on an unbounded plane\n");
+        printf("                 rather than the wrapping grid, and prints the population. Two-state rules without B0 only)\n");
+        printf("-j threads      (the number of threads to use. Default one per hardware thread)\n");
+        printf("-seed seed      (the seed used for pseudo-random number generation. Default RANDOM)\n");
+        return 0;
+    }
+
+    // 1) Parse command-line arguments.
+    int seed = 0;
+    int width = 100, height = 100;
+    const char* rule = "B3/S23";
+    float density = 0.3f;
+    const char* path = nullptr;
+    int bench = 0;
+    unsigned long long hashlife = 0;
+    for(int i = 0; i < argc; i++)
+    {
+        if(strcmp(argv[i], "-s") == 0)
+        {
+            width = atoi(argv[i + 1]);
+            height = atoi(argv[i + 2]);
+        }
+        else if(strcmp(argv[i], "-rule") == 0)
+        {
+            rule = argv[i + 1];
+        }
+        else if(strcmp(argv[i], "-d") == 0)
+        {
+            density = atof(argv[i + 1]);
+        }
+        else if(strcmp(argv[i], "-pattern") == 0)
+        {
+            path = argv[i + 1];
+        }
+        else if(strcmp(argv[i], "-bench") == 0)
+        {
+            bench = atoi(argv[i + 1]);
+        }
+        else if(strcmp(argv[i], "-hashlife") == 0)
+        {
+            hashlife = strtoull(argv[i + 1], nullptr, 10);
+        }
+        else if(strcmp(argv[i], "-j") == 0)
+        {
+            Parallel::threads = atoi(argv[i + 1]);
+        }
+        else if(strcmp(argv[i], "-seed") == 0)
+        {
+            seed = atoi(argv[i + 1]);
+        }
+    }
+
+    Pattern pattern;
+    if(path != nullptr)
+    {
+        if(!pattern.load(path))
+        {
+            fprintf(stderr, "Failed to read pattern '%s'!\n", path);
+            return 1;
+        }
+
+        // A rule given on the command line overrides the pattern's.
+        bool given = false;
+        for(int i = 0; i < argc; i++) given = given || strcmp(argv[i], "-rule") == 0;
+        if(!given && !pattern.rule.empty()) rule = pattern.rule.c_str();
+    }
+
+    LifeRule compiled;
+    if(!compiled.parse(rule))
+    {
+        fprintf(stderr, "Failed to parse rule '%s'!\n", rule);
+        return 1;
+    }
+
+    // 2) Initialise the model.
+    if(seed) srand(seed);
+    else srand(time(NULL));
+
+    Life life = Life(width, height, compiled, density, (path != nullptr) ? &pattern : nullptr);
+
+    // 3) Without a viewer, time the model, or jump ahead with HashLife, and quit.
+    if(bench)
+    {
+        auto start = std::chrono::steady_clock::now();
+        life.advance(bench);
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+        printf("%d steps of %dx%d in %.3f ms (%.3f ms/step, %.1f Mcells/s), %lld alive\n", bench, width, height,
+               elapsed.count(), elapsed.count() / bench, (double) width * height * bench / elapsed.count() / 1e3, life.population());
+        return 0;
+    }
+
+    if(hashlife)
+    {
+        if(!HashLife::supports(compiled))
+        {
+            fprintf(stderr, "HashLife needs a two-state rule without B0!\n");
+            return 1;
+        }
+
+        // A pattern is taken as it is; otherwise, the grid's random cells.
+        std::vector<std::pair<long long, long long>> cells;
+        if(path != nullptr)
+        {
+            for(const auto& cell : pattern.cells) cells.emplace_back(cell.first, cell.second);
+        }
+        else
+        {
+            life.alive(cells);
+        }
+
+        HashLife engine(compiled);
+        engine.load(cells);
+
+        auto start = std::chrono::steady_clock::now();
+        engine.advance(hashlife);
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+        printf("generation %llu in %.3f ms, %llu alive, %zu nodes\n", (unsigned long long) engine.generation(),
+               elapsed.count(), (unsigned long long) engine.population(), engine.nodes());
+        return 0;
+    }
+
+    // 4) Initialise model viewer.
+    if(!Viewer::Init("Life-like cellular automaton", argc, argv))
+    {
+        fprintf(stderr, "Failed to initialise model viewer!\n");
+        return 1;
+    }
+
+    // 5) Attach the model to a viewer.
+    Viewer::Get()->run(&life);
+    Viewer::Quit();
+    return 0;
+}
+
+
+const SDL_Colour ModelCA::COLOURS[2] = {
+    {250, 253, 255, 255},
+    {32, 32, 48, 255}
+};
+
+const unsigned char LifeRule::DEAD, LifeRule::ALIVE;
+
+bool LifeRule::parse(const char* rule)
+{
+    bool birth[9] = {false}, survival[9] = {false};
+    states = 2;
+
+    // Split the rule at each '/'. A part starting with a letter says what
+    // its counts are; otherwise the parts are survival, birth and states.
+    int part = 0;
+    for(const char* c = rule; ; part++)
+    {
+        const char* end = c + strcspn(c, "/");
+
+        char kind = std::toupper((unsigned char) *c);
+        if(std::isalpha((unsigned char) kind)) c++;
+        else kind = "SBC"[std::min(part, 2)];
+
+        if(part > 2 || c > end) return false;
+
+        if(kind == 'C' || kind == 'G')
+        {
+            if(c == end) return false;
+
+            states = 0;
+            for(; c < end; c++)
+            {
+                if(!std::isdigit((unsigned char) *c)) return false;
+                states = states * 10 + (*c - '0');
+                if(states > 256) return false;
+            }
+
+            if(states < 2) return false;
+        }
+        else if(kind == 'B' || kind == 'S')
+        {
+            for(; c < end; c++)
+            {
+                if(*c < '0' || *c > '8') return false;
+                (kind == 'B' ? birth : survival)[*c - '0'] = true;
+            }
+        }
+        else
+        {
+            return false;
+        }
+
+        if(*end == '\0') break;
+        c = end + 1;
+    }
+
+    table.assign(states * 9, DEAD);
+    for(int n = 0; n <= 8; n++)
+    {
+        table[DEAD * 9 + n] = (birth[n]) ? ALIVE : DEAD;
+        table[ALIVE * 9 + n] = (survival[n]) ? ALIVE : (states > 2) ? 2 : DEAD;
+
+        // Dying cells age, whatever their neighbours, until they're dead.
+        for(int s = 2; s < states; s++)
+            table[s * 9 + n] = (s + 1 < states) ? s + 1 : DEAD;
+    }
+
+    return true;
+}
+
+bool Pattern::load(const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if(file == NULL) return false;
+
+    width = height = 0;
+    cells.clear();
+    rule.clear();
+
+    // Comments start with '#'. The first other line is the header, as
+    // "x = 3, y = 3, rule = B3/S23", and the cells follow it, as runs of
+    // 'b' (dead) and 'o' (alive), with '$' ending each row and '!' the pattern.
+    char line[4096];
+    bool header = false, done = false;
+    int x = 0, y = 0, run = 0;
+    while(!done && fgets(line, sizeof(line), file) != NULL)
+    {
+        if(line[0] == '#') continue;
+
+        if(!header)
+        {
+            header = true;
+            sscanf(line, " x = %d , y = %d", &width, &height);
+
+            const char* r = strstr(line, "rule");
+            if(r != nullptr && (r = strchr(r, '=')) != nullptr)
+            {
+                r += strspn(r + 1, " \t") + 1;
+                rule.assign(r, strcspn(r, " \t\r\n,"));
+            }
+            continue;
+        }
+
+        for(const char* c = line; *c != '\0' && !done; c++)
+        {
+            if(std::isdigit((unsigned char) *c))
+            {
+                run = run * 10 + (*c - '0');
+                continue;
+            }
+
+            if(std::isspace((unsigned char) *c)) continue;
+
+            int n = std::max(run, 1);
+            run = 0;
+
+            if(*c == '!')
+            {
+                done = true;
+            }
+            else if(*c == '$')
+            {
+                y += n;
+                x = 0;
+            }
+            else if(*c == 'b' || *c == '.')
+            {
+                x += n;
+            }
+            else
+            {
+                for(; n > 0; n--) cells.emplace_back(x++, y);
+            }
+        }
+    }
+
+    fclose(file);
+
+    for(const auto& cell : cells)
+    {
+        width = std::max(width, cell.first + 1);
+        height = std::max(height, cell.second + 1);
+    }
+
+    return header;
+}
+
+Life::Life(int _width, int _height, const LifeRule& _rule, float _density, const Pattern* _pattern)
+    : StencilCA(_width, _height, _rule), density(_density)
+{
+    if(_pattern != nullptr) pattern = *_pattern;
+
+    init();
+}
+
+void Life::init()
+{
+    // Initialise model state. //
+    if(pattern.cells.empty())
+    {
+        unsigned char choices[2] = {LifeRule::DEAD, LifeRule::ALIVE};
+        float weights[2] = {1.0f - density, density};
+        init_cells(2, choices, weights);
+    }
+    else
+    {
+        // Centre the pattern, wrapping whatever doesn't fit around the edges.
+        std::fill(cells, cells + width * height, LifeRule::DEAD);
+
+        int xp = (width - pattern.width) / 2, yp = (height - pattern.height) / 2;
+        for(const auto& cell : pattern.cells)
+        {
+            int x = ((cell.first + xp) % width + width) % width;
+            int y = ((cell.second + yp) % height + height) % height;
+            cells[y * width + x] = LifeRule::ALIVE;
+        }
+    }
+
+    reseed();
+}
+
+long long Life::population() const
+{
+    return std::count(cells, cells + width * height, LifeRule::ALIVE);
+}
+
+void Life::alive(std::vector<std::pair<long long, long long>>& out) const
+{
+    for(int y = 0; y < height; y++)
+        for(int x = 0; x < width; x++)
+            if(cells[y * width + x] == LifeRule::ALIVE) out.emplace_back(x, y);
+}
+
+void Life::render(SDL_Surface* surface, SDL_Rect* dest, const ModelFrame* frame)
+{
+    const unsigned char* _cells = (frame != nullptr) ? ((ModelCAFrame*) frame)->cells : this->cells;
+
+    int cellSize = std::min(dest->w / width, dest->h / height);
+    int xp = (dest->w - cellSize * width) / 2;
+    int yp = (dest->h - cellSize * height) / 2;
+
+    for(int y = 0; y < height; y++)
+    {
+        for(int x = 0; x < width; x++)
+        {
+            // Dying cells fade from orange towards the colour of dead cells.
+            unsigned char state = _cells[y * width + x];
+
+            SDL_Colour c = COLOURS[std::min<int>(state, LifeRule::ALIVE)];
+            if(state > LifeRule::ALIVE)
+            {
+                int fade = 255 * (state - 1) / (rule.states - 1);
+                c = {(Uint8) (255 - fade * 5 / 255), (Uint8) (128 + fade * 125 / 255), (Uint8) (32 + fade * 223 / 255), 255};
+            }
+
+            SDL_Rect r = {x * cellSize + xp + dest->x, y * cellSize + yp + dest->y, cellSize, cellSize};
+            SDL_FillRect(surface, &r, SDL_MapRGB(surface->format, c.r, c.g, c.b));
+        }
+    }
+}
@@ -0,0 +1,99 @@
+/** life.hpp, based on
+ *  'Mathematical Games: The fantastic combinations of John Conway's new
+ *  solitaire game "life"' Martin Gardner (1970)
+ *
+ *  Copyright (C) 2021 Czespo
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef LIFE_HPP
+#define LIFE_HPP
+
+#include "../Stencil.hpp"
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * An outer-totalistic rule on the Moore neighbourhood, compiled into a
+ * table of each state's next state for each number of live neighbours.
+ * State 0 is dead and 1 is alive. With more than two states (a
+ * Generations rule), a live cell which doesn't survive passes through
+ * the states above 1 before dying, and can't be born again until then.
+ */
+struct LifeRule
+{
+    static const unsigned char DEAD = 0,
+                               ALIVE = 1;
+
+    /**
+     * Compiles `rule`, written as "B3/S23" (birth and survival counts),
+     * "B2/S/C3" (with a number of states), or "23/3" (survival, then
+     * birth). Returns false if `rule` isn't written like any of these.
+     */
+    bool parse(const char* rule);
+
+    unsigned char operator()(unsigned char state, const Stencil::Neighbours<Stencil::Moore>& neighbours, std::uint64_t) const
+    {
+        return table[state * 9 + neighbours.count(ALIVE)];
+    }
+
+    int states = 2;
+
+    /** The next state of state `s` with `n` live neighbours is at `s * 9 + n`. */
+    std::vector<unsigned char> table;
+};
+
+/**
+ * A pattern read from a run-length encoded (RLE) file, the format most
+ * Life programs save patterns in. Cells in any state but 'b' are alive.
+ */
+struct Pattern
+{
+    /** Returns false if the file can't be read. */
+    bool load(const char* path);
+
+    int width = 0, height = 0;
+    std::vector<std::pair<int, int>> cells;
+
+    /** The rule given in the file's header, if it gives one. */
+    std::string rule;
+};
+
+class Life : public StencilCA<Stencil::Moore, Stencil::Wrap, LifeRule>
+{
+    public:
+        /** If `pattern` isn't null, it's placed in the middle of the grid instead of random cells. */
+        Life(int _width, int _height, const LifeRule& _rule, float _density, const Pattern* _pattern=nullptr);
+        ~Life() {}
+
+        void init();
+
+        /** Returns the number of live cells. */
+        long long population() const;
+
+        /** Appends the position of each live cell to `out`. */
+        void alive(std::vector<std::pair<long long, long long>>& out) const;
+
+        void render(SDL_Surface* surface, SDL_Rect* dest, const ModelFrame* frame=nullptr);
+
+    private:
+        float density;
+        Pattern pattern;
+};
+
+#endif // LIFE_HPP
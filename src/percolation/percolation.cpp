@@ -22,9 +22,15 @@
 #include "../ModelCA.hpp"
 #include "../Viewer.hpp"
 #include "../Args.hpp"
+#include "../UnionFind.hpp"
+#include "../Parallel.hpp"
 
+#include <algorithm>
+#include <cstdint>
+#include <random>
 #include <vector>
 
+#include <cmath>
 #include <cstdlib>
 #include <cstdio>
 #include <ctime>
@@ -38,8 +44,13 @@ int main(int argc, char** argv)
         printf("-w width height (width and height of the viewer window. Default 800x600)\n");
         printf("-f              (makes the viewer window fullscreen)\n");
         printf("-fps fps        (frames per second of the viewer window. Default 30)\n");
+        printf("-spf steps      (the number of steps the model takes between frames. Default 1)\n");
         printf("-s width height (width and height of the model. Default 50x50)\n");
         printf("-q prob         (the probability that a cell is porous. Default 0.6)\n");
+        printf("-check          (prints whether the model percolates, and the sizes of its clusters, without a viewer)\n");
+        printf("-nz trials      (prints the probability of percolating and the size of the largest cluster for all q, averaged over many trials, without a viewer)\n");
+        printf("-trials count   (prints which of many trials percolate, running 64 trials at a time, without a viewer)\n");
+        printf("-j threads      (the number of threads to use. Default one per hardware thread)\n");
         printf("-seed seed      (the seed used for pseudo-random number generation. Default RANDOM)\n");
         return 0;
     }
@@ -47,17 +58,12 @@ int main(int argc, char** argv)
     // 0) Init args container.
     //Args args(argc, argv);
 
-    // 1) Initialise model viewer.
-    if(!Viewer::Init("Percolation model", argc, argv))
-    {
-        fprintf(stderr, "Failed to initialise model viewer!\n");
-        return 1;
-    }
-
-    // 2) Parse command-line arguments.
+    // 1) Parse command-line arguments.
     int seed = 0;
     int width = 50, height = 50;
     float q = 0.6f;
+    bool check = false;
+    int trials = 0, batch = 0;
     for(int i = 0; i < argc; i++)
     {
         if(strcmp(argv[i], "-s") == 0)
@@ -69,19 +75,93 @@ int main(int argc, char** argv)
         {
             q = atof(argv[i + 1]);
         }
+        else if(strcmp(argv[i], "-check") == 0)
+        {
+            check = true;
+        }
+        else if(strcmp(argv[i], "-nz") == 0)
+        {
+            trials = atoi(argv[i + 1]);
+        }
+        else if(strcmp(argv[i], "-trials") == 0)
+        {
+            batch = atoi(argv[i + 1]);
+        }
+        else if(strcmp(argv[i], "-j") == 0)
+        {
+            Parallel::threads = atoi(argv[i + 1]);
+        }
         else if(strcmp(argv[i], "-seed") == 0)
         {
             seed = atoi(argv[i + 1]);
         }
     }
 
-    // 3) Initialise the model.
-    if(seed) srand(seed);
-    else srand(time(NULL));
+    // 2) Initialise the model.
+    if(!seed) seed = time(NULL);
+    srand(seed);
+
+    if(trials)
+    {
+        Sweep sweep = Percolation::sweep(width, height, trials, seed);
+
+        printf("q     percolates  largest\n");
+        for(int i = 0; i <= 100; i++)
+        {
+            double q = i / 100.0;
+            printf("%.2f  %.6f    %.6f\n", q, Sweep::at(sweep.percolates, q), Sweep::at(sweep.largest, q));
+        }
+
+        return 0;
+    }
+
+    if(batch)
+    {
+        // Each word holds the results of 64 trials.
+        std::vector<std::uint64_t> results((batch + 63) / 64);
+        Parallel::for_range(0, results.size(), [&](int lo, int hi, int)
+        {
+            for(int i = lo; i < hi; i++)
+                results[i] = Percolation::trials64(width, height, q, Model::mix(seed) + i);
+        });
+
+        int percolated = 0;
+        for(int i = 0; i < batch; i++)
+        {
+            bool percolates = (results[i / 64] >> (i % 64)) & 1;
+            percolated += percolates;
+
+            putchar(percolates ? '1' : '0');
+            if(i % 64 == 63 || i == batch - 1) putchar('\n');
+        }
+
+        printf("percolates: %d of %d trials (%.6f)\n", percolated, batch, (double) percolated / batch);
+        return 0;
+    }
 
     Percolation percolation = Percolation(width, height, q);
 
-    // 4) Attach the model to a viewer.
+    // 3) Without a viewer, report on the model's clusters and quit.
+    if(check)
+    {
+        Clusters clusters = percolation.clusters();
+
+        printf("percolates: %s\n", clusters.percolates ? "yes" : "no");
+        printf("clusters:   %zu\n", clusters.sizes.size());
+        if(!clusters.sizes.empty())
+            printf("largest:    %d cells\n", clusters.sizes[0]);
+
+        return 0;
+    }
+
+    // 4) Initialise model viewer.
+    if(!Viewer::Init("Percolation model", argc, argv))
+    {
+        fprintf(stderr, "Failed to initialise model viewer!\n");
+        return 1;
+    }
+
+    // 5) Attach the model to a viewer.
     Viewer::Get()->run(&percolation);
     Viewer::Quit();
     return 0;
@@ -105,11 +185,13 @@ void Percolation::init()
     unsigned char choices[2] = {NONPOROUS, POROUS};
     float weights[2] = {1.0f - q, q};
 
+    frontier.clear();
     for(std::size_t i = 0, end = width * height; i < end; i++)
     {
         if(i < (std::size_t) width)
         {
             cells[i] = WET;
+            frontier.push_back(i);
         }
         else
         {
@@ -120,33 +202,310 @@ void Percolation::init()
 
 bool Percolation::update()
 {
-    std::vector<std::pair<int, int>> wet;
+    // Only cells wetted by the last step can wet any more cells. Each
+    // cell is marked as wet as soon as it is found, so it is only
+    // added to the next frontier once.
+    wetted.clear();
+    for(int i : frontier)
+    {
+        int x = i % width, y = i / width;
+
+        if(!outOfBounds(x, y - 1) && cell(x, y - 1) == POROUS)
+        {
+            cell(x, y - 1) = WET;
+            wetted.push_back(i - width);
+        }
+
+        if(!outOfBounds(x + 1, y) && cell(x + 1, y) == POROUS)
+        {
+            cell(x + 1, y) = WET;
+            wetted.push_back(i + 1);
+        }
+
+        if(!outOfBounds(x, y + 1) && cell(x, y + 1) == POROUS)
+        {
+            cell(x, y + 1) = WET;
+            wetted.push_back(i + width);
+        }
+
+        if(!outOfBounds(x - 1, y) && cell(x - 1, y) == POROUS)
+        {
+            cell(x - 1, y) = WET;
+            wetted.push_back(i - 1);
+        }
+    }
+
+    frontier.swap(wetted);
+
+    return frontier.empty();
+}
+
+Clusters Percolation::clusters()
+{
+    // Hoshen-Kopelman: scanning row by row, each cell need only
+    // be joined to the clusters of the cells above and to its left.
+    UnionFind sets(width * height);
     for(int y = 0; y < height; y++)
     {
         for(int x = 0; x < width; x++)
         {
-            if(cell(x, y) != WET)
+            if(cell(x, y) == NONPOROUS)
                 continue;
 
-            if(!outOfBounds(x, y - 1) && cell(x, y - 1) == POROUS)
-                wet.push_back(std::pair<int, int>(x, y - 1));
+            if(x > 0 && cell(x - 1, y) != NONPOROUS)
+                sets.unite(y * width + x, y * width + x - 1);
+
+            if(y > 0 && cell(x, y - 1) != NONPOROUS)
+                sets.unite(y * width + x, (y - 1) * width + x);
+        }
+    }
+
+    Clusters clusters;
+
+    // Mark the clusters which touch the top row, and
+    // check whether any of them reach the bottom row.
+    std::vector<bool> top(width * height, false);
+    for(int x = 0; x < width; x++)
+        if(cell(x, 0) != NONPOROUS) top[sets.find(x)] = true;
+
+    clusters.percolates = false;
+    for(int x = 0; x < width; x++)
+    {
+        if(cell(x, height - 1) != NONPOROUS && top[sets.find((height - 1) * width + x)])
+        {
+            clusters.percolates = true;
+            break;
+        }
+    }
+
+    for(int i = 0, end = width * height; i < end; i++)
+        if(cells[i] != NONPOROUS && sets.find(i) == i) clusters.sizes.push_back(sets.size(i));
+
+    std::sort(clusters.sizes.begin(), clusters.sizes.end(), std::greater<int>());
+    return clusters;
+}
+
+Sweep Percolation::sweep(int width, int height, int trials, unsigned int seed)
+{
+    // The top row is always wet, so only the cells below it are shuffled.
+    const int cells = width * height, sites = width * (height - 1);
+
+    // Each thread adds its trials' observables to its own totals, which
+    // are integers so that the result doesn't depend on the thread count.
+    std::vector<std::vector<std::int64_t>> percolates(Parallel::count()), largest(Parallel::count());
+
+    Parallel::for_range(0, trials, [&](int lo, int hi, int chunk)
+    {
+        std::vector<std::int64_t>& p = percolates[chunk];
+        std::vector<std::int64_t>& l = largest[chunk];
+        p.assign(sites + 1, 0);
+        l.assign(sites + 1, 0);
+
+        UnionFind sets;
+        std::vector<bool> porous, bottom;
+        std::vector<int> order(sites);
+
+        for(int trial = lo; trial < hi; trial++)
+        {
+            std::mt19937 random(seed + trial);
+
+            sets.reset(cells);
+            porous.assign(cells, false);
+            bottom.assign(cells, false);
+
+            // The top row is one wet cluster.
+            for(int x = 0; x < width; x++)
+            {
+                porous[x] = true;
+                sets.unite(0, x);
+            }
+
+            for(int x = 0; x < width; x++)
+                bottom[(height - 1) * width + x] = true;
 
-            if(!outOfBounds(x + 1, y) && cell(x + 1, y) == POROUS)
-                wet.push_back(std::pair<int, int>(x + 1, y));
+            bool spans = (height == 1);
+            int biggest = width;
 
-            if(!outOfBounds(x, y + 1) && cell(x, y + 1) == POROUS)
-                wet.push_back(std::pair<int, int>(x, y + 1));
+            for(int i = 0; i < sites; i++)
+                order[i] = width + i;
 
-            if(!outOfBounds(x - 1, y) && cell(x - 1, y) == POROUS)
-                wet.push_back(std::pair<int, int>(x - 1, y));
+            std::shuffle(order.begin(), order.end(), random);
+
+            p[0] += spans;
+            l[0] += biggest;
+
+            for(int n = 0; n < sites; n++)
+            {
+                int i = order[n], x = i % width, y = i / width;
+                porous[i] = true;
+
+                const int neighbours[4][3] = {
+                    {x, y - 1, i - width},
+                    {x + 1, y, i + 1},
+                    {x, y + 1, i + width},
+                    {x - 1, y, i - 1}
+                };
+
+                for(const int* neighbour : neighbours)
+                {
+                    if(neighbour[0] < 0 || neighbour[0] >= width || neighbour[1] < 0 || neighbour[1] >= height)
+                        continue;
+
+                    if(!porous[neighbour[2]])
+                        continue;
+
+                    bool touches = bottom[sets.find(i)] || bottom[sets.find(neighbour[2])];
+                    int root = sets.unite(i, neighbour[2]);
+                    bottom[root] = touches;
+
+                    biggest = std::max(biggest, sets.size(root));
+                }
+
+                if(!spans && bottom[sets.find(0)]) spans = true;
+
+                p[n + 1] += spans;
+                l[n + 1] += biggest;
+            }
         }
+    });
+
+    Sweep sweep;
+    sweep.percolates.assign(sites + 1, 0.0);
+    sweep.largest.assign(sites + 1, 0.0);
+
+    for(int n = 0; n <= sites; n++)
+    {
+        std::int64_t p = 0, l = 0;
+        for(std::size_t chunk = 0; chunk < percolates.size(); chunk++)
+        {
+            if(percolates[chunk].empty()) continue;
+
+            p += percolates[chunk][n];
+            l += largest[chunk][n];
+        }
+
+        sweep.percolates[n] = (double) p / trials;
+        sweep.largest[n] = (double) l / trials / cells;
     }
 
-    if(wet.size() == 0)
-        return true;
+    return sweep;
+}
+
+double Sweep::at(const std::vector<double>& curve, double q)
+{
+    const int n = curve.size() - 1;
+    if(q <= 0.0) return curve[0];
+    if(q >= 1.0) return curve[n];
+
+    // Start from the most likely count, and work outwards
+    // until the binomial weights become negligible.
+    int mode = std::min(n, (int) (q * (n + 1)));
+    double peak = std::exp(std::lgamma(n + 1.0) - std::lgamma(mode + 1.0) - std::lgamma(n - mode + 1.0)
+                           + mode * std::log(q) + (n - mode) * std::log(1.0 - q));
+
+    double sum = peak * curve[mode], total = peak;
+
+    double weight = peak;
+    for(int k = mode; k < n && weight > peak * 1e-16; k++)
+    {
+        weight *= (double) (n - k) / (k + 1) * q / (1.0 - q);
+        sum += weight * curve[k + 1];
+        total += weight;
+    }
+
+    weight = peak;
+    for(int k = mode; k > 0 && weight > peak * 1e-16; k--)
+    {
+        weight *= (double) k / (n - k + 1) * (1.0 - q) / q;
+        sum += weight * curve[k - 1];
+        total += weight;
+    }
+
+    return sum / total;
+}
+
+std::uint64_t Percolation::trials64(int width, int height, float q, std::uint64_t seed)
+{
+    std::vector<std::uint64_t> porous(width * height), wet(width * height, 0);
+
+    // Build each word from random words, one for each bit of q (from the
+    // least significant), ORing for a one and ANDing for a zero. Each bit of
+    // the result is then set with probability q, to 16 bits of precision.
+    // The random words hash the seed with the cell and the bit, so seeds
+    // which are close together don't share any of them.
+    const std::uint32_t threshold = std::min(std::max(q, 0.0f), 1.0f) * 65536.0f;
+    const std::uint64_t key = Model::mix(seed);
+    for(int i = width, end = width * height; i < end; i++)
+    {
+        std::uint64_t word = 0;
+        for(int bit = 0; bit < 16; bit++)
+        {
+            std::uint64_t random = Model::mix(key ^ ((std::uint64_t) i * 16 + bit));
+            word = ((threshold >> bit) & 1) ? (word | random) : (word & random);
+        }
+
+        porous[i] = (threshold >= 65536) ? ~UINT64_C(0) : word;
+    }
+
+    // The top row is wet in every trial.
+    for(int x = 0; x < width; x++)
+        porous[x] = wet[x] = ~UINT64_C(0);
+
+    // Spread the water until nothing changes. Each pass spreads it as far as
+    // it can go in one direction, so only a few passes are ever needed. The
+    // vertical passes treat each cell of a row independently, and vectorize.
+    std::uint64_t changed;
+    do
+    {
+        changed = 0;
+
+        for(int y = 1; y < height; y++)
+        {
+            std::uint64_t* row = &wet[y * width];
+            const std::uint64_t* above = row - width;
+            const std::uint64_t* p = &porous[y * width];
+
+            for(int x = 0; x < width; x++)
+            {
+                std::uint64_t w = row[x] | (p[x] & above[x]);
+                changed |= w ^ row[x];
+                row[x] = w;
+            }
+
+            for(int x = 1; x < width; x++)
+            {
+                std::uint64_t w = row[x] | (p[x] & row[x - 1]);
+                changed |= w ^ row[x];
+                row[x] = w;
+            }
+
+            for(int x = width - 2; x >= 0; x--)
+            {
+                std::uint64_t w = row[x] | (p[x] & row[x + 1]);
+                changed |= w ^ row[x];
+                row[x] = w;
+            }
+        }
+
+        for(int y = height - 2; y > 0; y--)
+        {
+            std::uint64_t* row = &wet[y * width];
+            const std::uint64_t* below = row + width;
+            const std::uint64_t* p = &porous[y * width];
+
+            for(int x = 0; x < width; x++)
+            {
+                std::uint64_t w = row[x] | (p[x] & below[x]);
+                changed |= w ^ row[x];
+                row[x] = w;
+            }
+        }
+    }
+    while(changed);
 
-    for(auto p : wet)
-        cell(p.first, p.second) = WET;
+    std::uint64_t percolates = 0;
+    for(int x = 0; x < width; x++)
+        percolates |= wet[(height - 1) * width + x];
 
-    return false;
+    return percolates;
 }
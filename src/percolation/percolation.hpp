@@ -22,6 +22,35 @@
 
 #include "../ModelCA.hpp"
 
+#include <cstdint>
+#include <vector>
+
+struct Clusters
+{
+    /** True iff a cluster connects the top row to the bottom row. */
+    bool percolates;
+
+    /** The number of cells in each cluster, largest first. */
+    std::vector<int> sizes;
+};
+
+struct Sweep
+{
+    /**
+     * Indexed by the number of porous cells below the top row: the
+     * fraction of trials which percolate, and the mean fraction of
+     * all cells which belong to the largest cluster.
+     */
+    std::vector<double> percolates, largest;
+
+    /**
+     * Returns the expected value of `curve` when each cell is porous
+     * with probability q, by weighting each entry with the binomial
+     * probability of that many cells being porous.
+     */
+    static double at(const std::vector<double>& curve, double q);
+};
+
 class Percolation : public ModelCA
 {
     public:
@@ -31,12 +60,38 @@ class Percolation : public ModelCA
         void init();
         bool update();
 
+        /**
+         * Labels the clusters of porous (and wet) cells in a single pass,
+         * without changing the model. Unlike stepping the model until it
+         * stops, this takes time proportional to the number of cells.
+         */
+        Clusters clusters();
+
+        /**
+         * Newman-Ziff: makes the cells below the top row porous one at a
+         * time, in a random order, and records the model's observables
+         * after each one. The result covers every value of q at once.
+         * Runs `trials` times in parallel and averages the results.
+         */
+        static Sweep sweep(int width, int height, int trials, unsigned int seed);
+
+        /**
+         * Runs 64 independent trials at once: bit k of each cell's words
+         * holds that cell's state in trial k, so each bitwise operation
+         * advances every trial. Returns a word whose bit k is set iff
+         * trial k percolates.
+         */
+        static std::uint64_t trials64(int width, int height, float q, std::uint64_t seed);
+
     private:
         const unsigned char NONPOROUS = 0,
                             POROUS = 1,
                             WET = 2;
 
         float q;
+
+        /** The cells which were wetted by the last step. */
+        std::vector<int> frontier, wetted;
 };
 
 #endif // PERCOLATION_HPP
@@ -21,8 +21,11 @@
 #include "schelling.hpp"
 
 #include "../ModelCA.hpp"
+#include "../Parallel.hpp"
 #include "../Viewer.hpp"
 
+#include <algorithm>
+
 #include <cstdlib>
 #include <cstdio>
 #include <ctime>
@@ -37,6 +40,7 @@ int main(int argc, char** argv)
         printf("-w width height (width and height of the viewer window. Default 800x600)\n");
         printf("-f              (makes the viewer window fullscreen)\n");
         printf("-fps fps        (frames per second of the viewer window. Default 30)\n");
+        printf("-spf steps      (the number of steps the model takes between frames. Default 1)\n");
         printf("-s width height (width and height of the model. Default 50x50)\n");
         printf("-d density      (the percentage of cells that are not empty. Default 0.9)\n");
         printf("-r red          (the percentage of non-empty cells that are red. Default 0.45)\n");
@@ -44,6 +48,7 @@ int main(int argc, char** argv)
         printf("-t blue         (the maximum percentage of opposite-coloured agents before an agent moves. Default 0.4)\n");
         printf("-n size         (the size of each agent's neighbourhood (in Chebyshev distance). Default 1)\n");
         printf("-fill           (when all agents are happy, fills empty cells with agents)\n");
+        printf("-j threads      (the number of threads to use. Default one per hardware thread)\n");
         printf("-seed seed      (the seed used for pseudo-random number generation. Default RANDOM)\n");
         return 0;
     }
@@ -95,6 +100,10 @@ int main(int argc, char** argv)
         {
             fill = true;
         }
+        else if(strcmp(argv[i], "-j") == 0)
+        {
+            Parallel::threads = atoi(argv[i + 1]);
+        }
         else if(strcmp(argv[i], "-seed") == 0)
         {
             seed = atoi(argv[i + 1]);
@@ -142,98 +151,202 @@ void Schelling::init()
             cell(x, y) = choice;
         }
     }
-}
 
-bool Schelling::update()
-{
-    if(!empty.size()) return true;
+    unhappy.clear();
+
+    stream = ((std::uint64_t) rand() << 32) ^ rand();
+    steps = 0;
+
+    if(n > LOCAL_RADIUS)
+    {
+        red_table.assign((width + 1) * (height + 1), 0);
+        blue_table.assign((width + 1) * (height + 1), 0);
+        return;
+    }
+
+    reds.assign(width * height, 0);
+    blues.assign(width * height, 0);
+    position.assign(width * height, -1);
 
-    std::vector<std::pair<int, int>> unhappy;
     for(int y = 0; y < height; y++)
     {
         for(int x = 0; x < width; x++)
         {
             if(cell(x, y) != EMPTY)
+                count(x, y, cell(x, y), 1);
+        }
+    }
+}
+
+bool Schelling::discontent(unsigned char colour, int reds, int blues)
+{
+    int neighbours = reds + blues;
+    if(colour == EMPTY || neighbours == 0)
+        return false;
+
+    float frac_red = (float) reds / neighbours;
+    float frac_blue = (float) blues / neighbours;
+
+    return (colour == RED) ? frac_red < threshold : frac_blue < threshold;
+}
+
+void Schelling::neighbours(int x, int y, int* reds, int* blues)
+{
+    if(n <= LOCAL_RADIUS)
+    {
+        *reds = this->reds[y * width + x];
+        *blues = this->blues[y * width + x];
+        return;
+    }
+
+    int x0 = std::max(x - n, 0), x1 = std::min(x + n, width - 1) + 1;
+    int y0 = std::max(y - n, 0), y1 = std::min(y + n, height - 1) + 1;
+    int stride = width + 1;
+
+    *reds = red_table[y1 * stride + x1] - red_table[y0 * stride + x1] - red_table[y1 * stride + x0] + red_table[y0 * stride + x0];
+    *blues = blue_table[y1 * stride + x1] - blue_table[y0 * stride + x1] - blue_table[y1 * stride + x0] + blue_table[y0 * stride + x0];
+
+    // Don't count the cell itself.
+    if(cell(x, y) == RED) (*reds)--;
+    else if(cell(x, y) == BLUE) (*blues)--;
+}
+
+void Schelling::tabulate()
+{
+    const int stride = width + 1;
+
+    // Sum along each row, then add each row's sums to the next.
+    // Rows, and then columns, can be summed independently.
+    Parallel::for_range(0, height, [&](int lo, int hi, int)
+    {
+        for(int y = lo; y < hi; y++)
+        {
+            int r = 0, b = 0;
+            for(int x = 0; x < width; x++)
             {
-                int red = 0, blue = 0;
-                for(int sy = y - n; sy <= y + n; sy++)
-                {
-                    if(sy < 0 || sy >= height)
-                        continue;
-
-                    for(int sx = x - n; sx <= x + n; sx++)
-                    {
-                        if(sx < 0 || sx >= width || (sx == x && sy == y))
-                            continue;
-
-                        if(cell(sx, sy) == RED)
-                        {
-                            red++;
-                        }
-                        else if(cell(sx, sy) == BLUE)
-                        {
-                            blue++;
-                        }
-                    }
-                }
+                r += (cell(x, y) == RED);
+                b += (cell(x, y) == BLUE);
+
+                red_table[(y + 1) * stride + x + 1] = r;
+                blue_table[(y + 1) * stride + x + 1] = b;
+            }
+        }
+    });
 
-                int neighbours = red + blue;
-                if(neighbours != 0)
+    Parallel::for_range(1, stride, [&](int lo, int hi, int)
+    {
+        for(int y = 2; y <= height; y++)
+        {
+            for(int x = lo; x < hi; x++)
+            {
+                red_table[y * stride + x] += red_table[(y - 1) * stride + x];
+                blue_table[y * stride + x] += blue_table[(y - 1) * stride + x];
+            }
+        }
+    });
+}
+
+void Schelling::count(int x, int y, unsigned char colour, int delta)
+{
+    std::vector<int>& counts = (colour == RED) ? reds : blues;
+    for(int sy = std::max(y - n, 0), ey = std::min(y + n, height - 1); sy <= ey; sy++)
+    {
+        for(int sx = std::max(x - n, 0), ex = std::min(x + n, width - 1); sx <= ex; sx++)
+        {
+            if(sx == x && sy == y)
+                continue;
+
+            counts[sy * width + sx] += delta;
+            check(sy * width + sx);
+        }
+    }
+}
+
+void Schelling::check(int i)
+{
+    bool sad = discontent(cells[i], reds[i], blues[i]);
+
+    if(sad && position[i] < 0)
+    {
+        position[i] = unhappy.size();
+        unhappy.push_back(i);
+    }
+    else if(!sad && position[i] >= 0)
+    {
+        // Swap the last unhappy agent into this one's place.
+        int last = unhappy.back();
+        unhappy[position[i]] = last;
+        position[last] = position[i];
+
+        unhappy.pop_back();
+        position[i] = -1;
+    }
+}
+
+bool Schelling::update()
+{
+    if(!empty.size()) return true;
+
+    // Find the agents to move, in the order they appear in the grid. //
+    if(n > LOCAL_RADIUS)
+    {
+        tabulate();
+
+        // Each thread checks a band of rows. Joining their
+        // results in order keeps the agents in grid order.
+        found.resize(Parallel::count());
+        Parallel::for_range(0, height, [&](int lo, int hi, int chunk)
+        {
+            found[chunk].clear();
+            for(int y = lo; y < hi; y++)
+            {
+                for(int x = 0; x < width; x++)
                 {
-                    float frac_red = (float) red / neighbours;
-                    float frac_blue = (float) blue / neighbours;
-
-                    if(cell(x, y) == RED && frac_red < threshold)
-                    {
-                        unhappy.push_back(std::pair<int, int>(x, y));
-                    }
-                    else if(cell(x, y) == BLUE && frac_blue < threshold)
-                    {
-                        unhappy.push_back(std::pair<int, int>(x, y));
-                    }
+                    int r, b;
+                    neighbours(x, y, &r, &b);
+                    if(discontent(cell(x, y), r, b)) found[chunk].push_back(y * width + x);
                 }
             }
+        });
+
+        moving.clear();
+        for(std::vector<int>& agents : found)
+        {
+            moving.insert(moving.end(), agents.begin(), agents.end());
+            agents.clear();
         }
     }
+    else
+    {
+        moving.assign(unhappy.begin(), unhappy.end());
+        std::sort(moving.begin(), moving.end());
+    }
 
-    if(unhappy.size() == 0)
+    if(moving.size() == 0)
     {
         if(fill)
         {
-            // Fill all empty cells with red or blue agents.
-            for(int y = 0; y < height; y++)
+            // Fill all empty cells with agents of the colour which is most
+            // common in their neighbourhood. Every colour is chosen before
+            // any cell is filled, so no cell sees the others' new agents,
+            // however the neighbourhoods are counted.
+            std::vector<unsigned char> colours(empty.size());
+            for(std::size_t k = 0; k < empty.size(); k++)
             {
-                for(int x = 0; x < width; x++)
+                int r, b;
+                neighbours(empty[k].first, empty[k].second, &r, &b);
+                colours[k] = (r > b) ? RED : BLUE;
+            }
+
+            for(std::size_t k = 0; k < empty.size(); k++)
+            {
+                int x = empty[k].first, y = empty[k].second;
+                cell(x, y) = colours[k];
+
+                if(n <= LOCAL_RADIUS)
                 {
-                    if(cell(x, y) != EMPTY) continue;
-
-                    int red = 0, blue = 0;
-                    for(int sy = y - n; sy <= y + n; sy++)
-                    {
-                        if(sy < 0 || sy >= height)
-                            continue;
-
-                        for(int sx = x - n; sx <= x + n; sx++)
-                        {
-                            if(sx < 0 || sx >= width || (sx == x && sy == y))
-                                continue;
-
-                            if(cell(sx, sy) == RED)
-                            {
-                                red++;
-                            }
-                            else if(cell(sx, sy) == BLUE)
-                            {
-                                blue++;
-                            }
-                        }
-                    }
-
-                    int neighbours = red + blue;
-                    float frac_red = red / neighbours;
-                    float frac_blue = blue / neighbours;
-
-                    cell(x, y) = (frac_red > frac_blue) ? RED : BLUE;
+                    check(y * width + x);
+                    count(x, y, colours[k], 1);
                 }
             }
 
@@ -243,16 +356,32 @@ bool Schelling::update()
         return true;
     }
 
-    // Move unhappy agents to random empty locations. //
-    for(auto p : unhappy)
+    // Move unhappy agents to random empty locations. Agents which
+    // become unhappy (or happy) because of these moves are not
+    // moved until the next step. //
+    for(int i : moving)
     {
-        int index = rand() % empty.size();
+        std::uint64_t random = Model::mix(stream + steps * width * height + i);
+        int index = random % empty.size();
         int dx = empty[index].first, dy = empty[index].second;
+        int x = i % width, y = i / width;
+
+        unsigned char colour = cells[i];
+        cells[i] = EMPTY;
+        cell(dx, dy) = colour;
+
+        if(n <= LOCAL_RADIUS)
+        {
+            check(i);
+            count(x, y, colour, -1);
+
+            check(dy * width + dx);
+            count(dx, dy, colour, 1);
+        }
 
-        cell(dx, dy) = cell(p.first, p.second);
-        cell(p.first, p.second) = EMPTY;
-        empty[index] = p;
+        empty[index] = std::pair<int, int>(x, y);
     }
 
+    steps++;
     return false;
 }
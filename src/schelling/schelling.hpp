@@ -23,6 +23,7 @@
 
 #include "../ModelCA.hpp"
 
+#include <cstdint>
 #include <vector>
 
 class Schelling : public ModelCA
@@ -39,8 +40,61 @@ class Schelling : public ModelCA
                             RED = 1,
                             BLUE = 2;
 
+        /**
+         * Neighbourhoods larger than this are counted with summed-area
+         * tables, instead of keeping every cell's counts up to date.
+         */
+        static const int LOCAL_RADIUS = 3;
+
+        /** Returns true iff an agent of the given colour would be unhappy with these neighbours. */
+        bool discontent(unsigned char colour, int reds, int blues);
+
+        /** Writes the number of red and blue agents around (x, y) to the out-arguments. */
+        void neighbours(int x, int y, int* reds, int* blues);
+
+        /** Rebuilds `red_table` and `blue_table` from the current grid. */
+        void tabulate();
+
+        /**
+         * Adds `delta` agents of the given colour to the neighbourhood
+         * counts of every cell around (x, y), and updates whether the
+         * agents in those cells are unhappy.
+         */
+        void count(int x, int y, unsigned char colour, int delta);
+
+        /** Adds or removes the agent in cell `i` from `unhappy`, as appropriate. */
+        void check(int i);
+
         std::vector<std::pair<int, int>> empty;
 
+        /**
+         * The number of red and blue agents in each cell's neighbourhood,
+         * not counting the cell itself. These are kept up to date as agents
+         * move, so a step only costs as much as the agents who move.
+         */
+        std::vector<int> reds, blues;
+
+        /** The unhappy agents' cells, and each cell's index in `unhappy` (or -1). */
+        std::vector<int> unhappy, position, moving;
+
+        /**
+         * Entry (y * (width + 1) + x) of each table holds the number of red
+         * (or blue) agents in the cells above and to the left of (x, y). Any
+         * neighbourhood can be counted from four entries, however large n is.
+         */
+        std::vector<int> red_table, blue_table;
+
+        /** The unhappy agents found by each thread. */
+        std::vector<std::vector<int>> found;
+
+        /**
+         * Each move's destination is drawn by hashing the step, the agent's
+         * cell and a seed, rather than with `rand()`. The result doesn't
+         * depend on which thread found the agent, or when.
+         */
+        std::uint64_t stream;
+        std::uint64_t steps;
+
         float threshold, red, blue;
         int n;
         bool fill;
@@ -22,14 +22,25 @@
 
 #include "../Model.hpp"
 #include "../ModelCA.hpp"
+#include "../Parallel.hpp"
 #include "../Viewer.hpp"
 
+#include <algorithm>
+
+#include <cctype>
 #include <cstdlib>
 #include <cstring>
 #include <cstdio>
 #include <cmath>
 #include <ctime>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 int main(int argc, char** argv)
 {
     // -1) Quick termination if the user wants help.
@@ -39,8 +50,13 @@ int main(int argc, char** argv)
         printf("-w width height (width and height of the viewer window. Default 800x600)\n");
         printf("-f              (makes the viewer window fullscreen)\n");
         printf("-fps fps        (frames per second of the viewer window. Default 30)\n");
+        printf("-spf steps      (the number of steps the model takes between frames. Default 1)\n");
         printf("-s width height (width and height of the model. Default 50x50)\n");
         printf("-a agents       (the number of agents to place in the model. Default 400)\n");
+        printf("-map file       (reads each cell's sugar capacity from a binary PGM file, or a raw file of -s width by height bytes from 0 to 4)\n");
+        printf("-tiled          (moves agents in separate parts of the model in parallel)\n");
+        printf("-morton steps   (sorts the agents in memory by their position every so many steps. Default 0, never)\n");
+        printf("-j threads      (the number of threads to use. Default one per hardware thread)\n");
         printf("-seed seed      (the seed used for pseudo-random number generation. Default RANDOM)\n");
         return 0;
     }
@@ -55,6 +71,9 @@ int main(int argc, char** argv)
     // 2) Parse command-line arguments.
     int seed = 0;
     int width = 50, height = 50, agents = 400;
+    bool tiled = false;
+    int morton = 0;
+    const char* map = nullptr;
     for(int i = 0; i < argc; i++)
     {
         if(strcmp(argv[i], "-s") == 0)
@@ -66,6 +85,22 @@ int main(int argc, char** argv)
         {
             agents = atoi(argv[i + 1]);
         }
+        else if(strcmp(argv[i], "-map") == 0)
+        {
+            map = argv[i + 1];
+        }
+        else if(strcmp(argv[i], "-tiled") == 0)
+        {
+            tiled = true;
+        }
+        else if(strcmp(argv[i], "-morton") == 0)
+        {
+            morton = atoi(argv[i + 1]);
+        }
+        else if(strcmp(argv[i], "-j") == 0)
+        {
+            Parallel::threads = atoi(argv[i + 1]);
+        }
         else if(strcmp(argv[i], "-seed") == 0)
         {
             seed = atoi(argv[i + 1]);
@@ -76,7 +111,20 @@ int main(int argc, char** argv)
     if(seed) srand(seed);
     else srand(time(NULL));
 
-    Sugarscape sugarscape = Sugarscape(width, height, agents);
+    Landscape landscape;
+    if(map != nullptr)
+    {
+        if(!landscape.load(map, width, height))
+        {
+            fprintf(stderr, "Failed to read landscape '%s'!\n", map);
+            return 1;
+        }
+
+        width = landscape.width;
+        height = landscape.height;
+    }
+
+    Sugarscape sugarscape = Sugarscape(width, height, agents, tiled, morton, (map != nullptr) ? &landscape : nullptr);
 
     // 4) Attach the model to a viewer.
     Viewer::Get()->run(&sugarscape);
@@ -85,11 +133,137 @@ int main(int argc, char** argv)
 }
 
 
-Agent::Agent(int _x, int _y) : x(_x), y(_y)
+bool Landscape::load(const char* path, int _width, int _height)
 {
-    sugar = Model::randint(5, 26);
-    vision = Model::randint(1, 7);
-    metabolism = Model::randint(1, 4);
+    std::size_t size = 0;
+    const unsigned char* data = nullptr;
+
+#if defined(__unix__) || defined(__APPLE__)
+    // Map the file rather than copying it, as it may be large.
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return false;
+
+    struct stat info;
+    if(fstat(fd, &info) == 0 && info.st_size > 0)
+    {
+        size = info.st_size;
+        void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mapping != MAP_FAILED) data = (const unsigned char*) mapping;
+    }
+
+    close(fd);
+#else
+    std::vector<unsigned char> buffer;
+
+    FILE* file = fopen(path, "rb");
+    if(file == NULL) return false;
+
+    unsigned char chunk[4096];
+    std::size_t read;
+    while((read = fread(chunk, 1, sizeof(chunk), file)) > 0)
+        buffer.insert(buffer.end(), chunk, chunk + read);
+
+    fclose(file);
+
+    size = buffer.size();
+    if(size > 0) data = buffer.data();
+#endif
+
+    if(data == nullptr) return false;
+
+    // Read the PGM header, if any: the magic number, width, height
+    // and maximum value, separated by whitespace and comments.
+    std::size_t pos = 0;
+    int fields[3] = {_width, _height, 4};
+    bool pgm = (size > 2 && data[0] == 'P' && data[1] == '5');
+    if(pgm)
+    {
+        pos = 2;
+        for(int f = 0; f < 3; f++)
+        {
+            while(pos < size && (std::isspace(data[pos]) || data[pos] == '#'))
+            {
+                if(data[pos] == '#')
+                    while(pos < size && data[pos] != '\n') pos++;
+                else
+                    pos++;
+            }
+
+            fields[f] = 0;
+            while(pos < size && std::isdigit(data[pos]))
+                fields[f] = fields[f] * 10 + (data[pos++] - '0');
+        }
+
+        // A single whitespace character ends the header.
+        pos++;
+    }
+
+    width = fields[0];
+    height = fields[1];
+    int maximum = fields[2];
+
+    // Samples wider than a byte are stored most significant byte first.
+    int bytes = (maximum > 255) ? 2 : 1;
+
+    bool ok = width > 0 && height > 0 && maximum > 0 && pos <= size
+              && (size - pos) / bytes / width >= (std::size_t) height;
+    if(ok)
+    {
+        capacity.resize(width * height);
+        for(int i = 0, end = width * height; i < end; i++)
+        {
+            int value = (bytes == 2) ? (data[pos + 2 * i] << 8 | data[pos + 2 * i + 1]) : data[pos + i];
+            capacity[i] = (pgm) ? (std::min(value, maximum) * 4 + maximum / 2) / maximum : std::min(value, 4);
+        }
+    }
+
+#if defined(__unix__) || defined(__APPLE__)
+    munmap((void*) data, size);
+#endif
+
+    return ok;
+}
+
+std::size_t Agents::size() const
+{
+    return x.size();
+}
+
+void Agents::clear()
+{
+    x.clear();
+    y.clear();
+    sugar.clear();
+    vision.clear();
+    metabolism.clear();
+}
+
+void Agents::add(int _x, int _y)
+{
+    x.push_back(_x);
+    y.push_back(_y);
+    sugar.push_back(Model::randint(5, 26));
+    vision.push_back(Model::randint(1, 7));
+    metabolism.push_back(Model::randint(1, 4));
+}
+
+std::size_t Agents::remove(std::size_t i)
+{
+    std::size_t last = size() - 1;
+
+    x[i] = x[last];
+    y[i] = y[last];
+    sugar[i] = sugar[last];
+    vision[i] = vision[last];
+    metabolism[i] = metabolism[last];
+
+    x.pop_back();
+    y.pop_back();
+    sugar.pop_back();
+    vision.pop_back();
+    metabolism.pop_back();
+
+    return last;
 }
 
 const SDL_Colour ModelCA::COLOURS[5] = {
@@ -100,9 +274,12 @@ const SDL_Colour ModelCA::COLOURS[5] = {
     {0xFD, 0xB1, 0x69, 0xFF}
 };
 
-Sugarscape::Sugarscape(int _width, int _height, int _agents)
-    : ModelCA(_width, _height), capacity(new unsigned char[_width * _height]{}), nagents(_agents)
+Sugarscape::Sugarscape(int _width, int _height, int _agents, bool _tiled, int _morton, const Landscape* _landscape)
+    : ModelCA(_width, _height), capacity(new unsigned char[_width * _height]{}), nagents(_agents), tiled(_tiled), morton(_morton)
 {
+    if(_landscape != nullptr)
+        landscape = _landscape->capacity;
+
     init();
 }
 
@@ -113,133 +290,164 @@ Sugarscape::~Sugarscape()
 
 void Sugarscape::init()
 {
-    // Add sugarspots. //
-    sugarspot(35, 15);
-    sugarspot(15, 35);
+    // The tiled step's stream is derived from the same seed, so that it
+    // doesn't take anything more from `rand()` than the untiled step did.
+    const unsigned int seed = rand();
+    random.seed(seed);
 
-    agents.clear();
+    // Add sugar. //
+    if(!landscape.empty())
+    {
+        std::memcpy(capacity, landscape.data(), width * height);
+    }
+    else
+    {
+        std::memset(capacity, 0, width * height);
 
-    // Add agents. //
-    unsigned char* positions = new unsigned char[width * height]{};
-    for(int i = 0; i < nagents; i++) positions[i] = 1;
+        // Placed as on the original 50x50 grid, scaled to fit.
+        sugarspot(width * 7 / 10, height * 3 / 10);
+        sugarspot(width * 3 / 10, height * 7 / 10);
+    }
 
-    // Shuffle array.
-    shuffle(width * height, positions);
+    std::memcpy(cells, capacity, width * height);
+    harvested.assign(width * height, 0);
 
-    // Use positions to spawn agents.
-    for(int y = 0; y < height; y++)
+    // Add agents. //
+    agents.clear();
+    occupant.assign(width * height, -1);
+
+    // Choose the agents' cells with Floyd's algorithm, which samples
+    // without replacement in time proportional to the number of agents.
+    // Each new cell is either a random one, or (if that is already taken)
+    // the last cell in the range, which can't have been chosen yet.
+    const int count = std::min(nagents, width * height);
+    for(int j = width * height - count; j < width * height; j++)
     {
-        for(int x = 0; x < width; x++)
-        {
-            if(positions[y * width + x]) agents.push_back(Agent(x, y));
-        }
+        int c = std::uniform_int_distribution<int>(0, j)(random);
+        if(occupant[c] >= 0) c = j;
+
+        occupant[c] = agents.size();
+        agents.add(c % width, c / width);
     }
 
-    delete[] positions;
+    stream = Model::mix(seed);
+    steps = 0;
 }
 
 void Sugarscape::sugarspot(int cx, int cy)
 {
-    int thickness = 5;
-    for(int y = 0; y < height; y++)
+    // Cells further than this from the centre get no sugar.
+    const int thickness = 5, radius = thickness * thickness - thickness;
+
+    for(int y = std::max(cy - radius, 0), ey = std::min(cy + radius, height - 1); y <= ey; y++)
     {
-        for(int x = 0; x < width; x++)
+        for(int x = std::max(cx - radius, 0), ex = std::min(cx + radius, width - 1); x <= ex; x++)
         {
             double distance = hypot(cy - y, cx - x);
             int level = ceil(thickness - (distance + thickness - 1) / thickness);
             if(level >= thickness)
                 level = 4;
 
-            if(level > cell(x, y))
-            {
-                cell(x, y) = level;
+            if(level > capacity[y * width + x])
                 capacity[y * width + x] = level;
-            }
         }
     }
 }
 
-bool Sugarscape::empty(int x, int y)
+void Sugarscape::move(std::size_t i, std::uint64_t random)
 {
-    for(Agent agent : agents)
-        if(agent.x == x && agent.y == y)
-            return false;
-
-    return true;
-}
-
-const std::pair<int, int> INC[4] = {
-    { 0, -1}, // Up
-    { 1,  0},  // Right
-    { 0,  1},  // Down
-    {-1,  0}  // Left
-};
-
-void Sugarscape::move(Agent& agent)
-{
-    std::vector<std::pair<int, int>> options;
-    int richest = 0;
+    const int x = agents.x[i], y = agents.y[i], vision = agents.vision[i];
+
+    // How far the agent can see along each ray (up, right, down
+    // and left) before reaching the edge, and one step along it.
+    const int reach[4] = {
+        std::min(vision, y),
+        std::min(vision, width - 1 - x),
+        std::min(vision, height - 1 - y),
+        std::min(vision, x)
+    };
+
+    const int step[4] = {-width, 1, width, -1};
+
+    // Along a ray, a cell's distance is just the number of steps to it.
+    // Only the nearest of the richest cells on each ray can be chosen,
+    // so there are never more than four options.
+    int options[4], count = 0;
+    int richest = 0, closest = 0;
     for(int d = 0; d < 4; d++)
     {
-        int x = agent.x, y = agent.y, m = 0;
-        while(m++ < agent.vision)
+        int c = y * width + x;
+        for(int m = 1; m <= reach[d]; m++)
         {
-            x += INC[d].first;
-            y += INC[d].second;
+            c += step[d];
+            if(occupant[c] >= 0) continue;
 
-            if(outOfBounds(x, y)) break;
-
-            if(empty(x, y))
+            int sugar = available(c);
+            if(sugar > richest || (sugar == richest && (count == 0 || m < closest)))
             {
-                if(cell(x, y) > richest)
-                {
-                    richest = cell(x, y);
-                    options.clear();
-                    options.push_back(std::pair<int, int>(x, y));
-                }
-                else if(cell(x, y) == richest)
-                {
-                    options.push_back(std::pair<int, int>(x, y));
-                }
+                richest = sugar;
+                closest = m;
+                options[0] = c;
+                count = 1;
+            }
+            else if(sugar == richest && m == closest)
+            {
+                options[count++] = c;
             }
         }
     }
 
     // The agent cannot move because all of its
     // potential options were occupied.
-    if(options.size() == 0) return;
+    if(count == 0) return;
 
-    // Of options, determine the closest locations. //
-    std::size_t theta = 0;
-    double closest = 99;
-    for(auto it = options.crbegin(), end = options.crend(); it != end; it++)
+    int choice = options[random % count];
+
+    agents.x[i] = choice % width;
+    agents.y[i] = choice / width;
+}
+
+/** Spreads the bits of `v` out to the even bits of the result. */
+static std::uint64_t spread(std::uint32_t v)
+{
+    std::uint64_t x = v;
+    x = (x | (x << 16)) & UINT64_C(0x0000FFFF0000FFFF);
+    x = (x | (x << 8)) & UINT64_C(0x00FF00FF00FF00FF);
+    x = (x | (x << 4)) & UINT64_C(0x0F0F0F0F0F0F0F0F);
+    x = (x | (x << 2)) & UINT64_C(0x3333333333333333);
+    x = (x | (x << 1)) & UINT64_C(0x5555555555555555);
+    return x;
+}
+
+void Sugarscape::sort()
+{
+    const std::size_t count = agents.size();
+
+    codes.resize(count);
+    for(std::size_t i = 0; i < count; i++)
+        codes[i] = std::pair<std::uint64_t, int>(spread(agents.x[i]) | (spread(agents.y[i]) << 1), i);
+
+    std::sort(codes.begin(), codes.end());
+
+    // Gather each attribute into its new order.
+    std::vector<int>* attributes[5] = {&agents.x, &agents.y, &agents.sugar, &agents.vision, &agents.metabolism};
+    for(std::vector<int>* attribute : attributes)
     {
-        double distance = hypot(agent.x - (*it).first, agent.y - (*it).second);
-        if(distance < closest)
-        {
-            closest = distance;
-            while(theta)
-            {
-                options.pop_back();
-                theta--;
-            }
+        scratch.resize(count);
+        for(std::size_t i = 0; i < count; i++)
+            scratch[i] = (*attribute)[codes[i].second];
 
-            theta++;
-        }
-        else if(distance == closest)
-        {
-            theta++;
-        }
-        else
-        {
-            options.erase(--(it.base()));
-        }
+        attribute->swap(scratch);
     }
 
-    std::pair<int, int> choice = options[rand() % options.size()];
+    for(std::size_t i = 0; i < count; i++)
+        occupant[agents.y[i] * width + agents.x[i]] = i;
+}
 
-    agent.x = choice.first;
-    agent.y = choice.second;
+int Sugarscape::available(int i) const
+{
+    std::uint32_t growth = (std::uint32_t) steps - harvested[i];
+    return std::min<std::uint32_t>(capacity[i], cells[i] + std::min<std::uint32_t>(growth, 255));
 }
 
 ModelFrame* Sugarscape::frame()
@@ -249,30 +457,143 @@ ModelFrame* Sugarscape::frame()
 
 bool Sugarscape::update()
 {
-    shuffle(agents.size(), (Agent*)(&agents[0]));
-    for(auto it = agents.begin(); it != agents.end(); )
+    // Shuffle the order the agents act in, rather than the agents.
+    order.resize(agents.size());
+    for(std::size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+
+    if(morton)
     {
-        // Move the agent.
-        move(*it);
+        if(steps % morton == 0) sort();
 
-        // Agent harvests sugar.
-        (*it).sugar += cell((*it).x, (*it).y) - (*it).metabolism;
-        cell((*it).x, (*it).y) = 0;
+        // Shuffle the blocks, then the agents within each block, so
+        // that the agents acting one after another are close together.
+        std::size_t blocks = (order.size() + BLOCK - 1) / BLOCK;
+
+        scratch.resize(blocks);
+        for(std::size_t b = 0; b < blocks; b++)
+            scratch[b] = b;
+
+        std::shuffle(scratch.begin(), scratch.end(), random);
+
+        std::size_t k = 0;
+        for(int b : scratch)
+        {
+            std::size_t start = k;
+            for(std::size_t i = b * BLOCK, end = std::min(i + BLOCK, agents.size()); i < end; i++)
+                order[k++] = i;
+
+            std::shuffle(order.begin() + start, order.begin() + k, random);
+        }
+    }
+    else
+    {
+        std::shuffle(order.begin(), order.end(), random);
+    }
 
-        // If agent is starving, remove it.
-        if((*it).sugar < 0)
+    if(tiled)
+    {
+        const int size = 2 * MAX_VISION;
+        const int columns = (width + size - 1) / size, rows = (height + size - 1) / size;
+
+        // Sort the agents by the tile they start in, keeping them in order. //
+        tile_start.assign(columns * rows + 1, 0);
+        for(int i : order)
+            tile_start[(agents.y[i] / size) * columns + agents.x[i] / size + 1]++;
+
+        for(int t = 0; t < columns * rows; t++)
+            tile_start[t + 1] += tile_start[t];
+
+        tile_agents.resize(order.size());
+        tile_end.assign(tile_start.begin(), tile_start.end() - 1);
+        for(int i : order)
+            tile_agents[tile_end[(agents.y[i] / size) * columns + agents.x[i] / size]++] = i;
+
+        // Move the agents in each colour of tile in turn, taking the colours
+        // in a new random order each step, so that no tiles always get the
+        // first pick of contested sugar. Within a tile, agents move one at a
+        // time in their shuffled order, and the result is the same whichever
+        // order the tiles of one colour are moved in. What remains of the
+        // grid's layout is that all the agents in tiles of one colour move
+        // before any in the next. //
+        int colours[4] = {0, 1, 2, 3};
+        std::shuffle(colours, colours + 4, random);
+        for(int colour : colours)
         {
-            it = agents.erase(it);
+            int cx = colour % 2, cy = colour / 2;
+            int across = (columns - cx + 1) / 2, down = (rows - cy + 1) / 2;
+
+            Parallel::for_range(0, across * down, [&](int lo, int hi, int)
+            {
+                for(int k = lo; k < hi; k++)
+                {
+                    int t = (cy + 2 * (k / across)) * columns + cx + 2 * (k % across);
+                    for(int a = tile_start[t]; a < tile_start[t + 1]; a++)
+                    {
+                        int i = tile_agents[a];
+
+                        occupant[agents.y[i] * width + agents.x[i]] = -1;
+                        move(i, Model::mix(stream + (steps << 32) + i));
+                        occupant[agents.y[i] * width + agents.x[i]] = i;
+                    }
+                }
+            });
         }
-        else
+    }
+    else
+    {
+        // Move the agents, one at a time. //
+        for(int i : order)
         {
-            it++;
+            occupant[agents.y[i] * width + agents.x[i]] = -1;
+            move(i, rand());
+            occupant[agents.y[i] * width + agents.x[i]] = i;
         }
     }
 
-    // Regrow sugar. //
-    for(std::size_t i = 0, end = width * height; i < end; i++)
-        if(cells[i] < capacity[i]) cells[i]++;
+    // Agents harvest sugar. No two agents share a cell, so these loops
+    // have no dependencies between iterations. The gather from the grid,
+    // the update of the agents and the scatter back to the grid are kept
+    // apart, so that the contiguous loops vectorize. //
+    const std::size_t count = agents.size();
+    site.resize(count);
+    harvest.resize(count);
+
+    const int* x = agents.x.data();
+    const int* y = agents.y.data();
+    int* s = site.data();
+    for(std::size_t i = 0; i < count; i++)
+        s[i] = y[i] * width + x[i];
+
+    int* h = harvest.data();
+    for(std::size_t i = 0; i < count; i++)
+        h[i] = available(s[i]);
+
+    int* sugar = agents.sugar.data();
+    const int* metabolism = agents.metabolism.data();
+    for(std::size_t i = 0; i < count; i++)
+        sugar[i] += h[i] - metabolism[i];
+
+    for(std::size_t i = 0; i < count; i++)
+    {
+        cells[s[i]] = 0;
+        harvested[s[i]] = steps;
+    }
+
+    // Starving agents die. Working backwards, the agent moved
+    // into a dead agent's place has already survived. //
+    for(std::size_t i = count; i-- > 0; )
+    {
+        if(agents.sugar[i] >= 0)
+            continue;
+
+        occupant[site[i]] = -1;
+        if(agents.remove(i) != i)
+            occupant[agents.y[i] * width + agents.x[i]] = i;
+    }
+
+    // Sugar regrows as it is read. //
+    steps++;
 
     return false;
 }
@@ -284,12 +605,12 @@ void Sugarscape::render(SDL_Surface* surface, SDL_Rect* dest, const ModelFrame*
     int yp = ((dest->h - cellSize * height) / 2) + dest->y;
 
     // Render terrain. //
-    unsigned char* _cells = (frame != nullptr) ? ((SugarscapeFrame*) frame)->cells : this->cells;
     for(int y = 0; y < height; y++)
     {
         for(int x = 0; x < width; x++)
         {
-            SDL_Colour c = COLOURS[_cells[y * width + x]];
+            int i = y * width + x;
+            SDL_Colour c = COLOURS[(frame != nullptr) ? ((SugarscapeFrame*) frame)->cells[i] : available(i)];
             SDL_Rect r = {x * cellSize + xp, y * cellSize + yp, cellSize, cellSize};
             SDL_FillRect(surface, &r, SDL_MapRGB(surface->format, c.r, c.g, c.b));
         }
@@ -302,9 +623,9 @@ void Sugarscape::render(SDL_Surface* surface, SDL_Rect* dest, const ModelFrame*
     yp += aq;
     if(frame == nullptr)
     {
-        for(Agent agent : agents)
+        for(std::size_t i = 0; i < agents.size(); i++)
         {
-            SDL_Rect r{agent.x * cellSize + xp, agent.y * cellSize + yp, ah, ah};
+            SDL_Rect r{agents.x[i] * cellSize + xp, agents.y[i] * cellSize + yp, ah, ah};
             SDL_FillRect(surface, &r, color);
         }
     }
@@ -325,11 +646,12 @@ void Sugarscape::render(SDL_Surface* surface, SDL_Rect* dest, const ModelFrame*
 SugarscapeFrame::SugarscapeFrame(const Sugarscape* model)
     : cells(new unsigned char[model->width * model->height])
 {
-    std::memcpy(cells, model->cells, model->width * model->height);
+    for(int i = 0, end = model->width * model->height; i < end; i++)
+        cells[i] = model->available(i);
 
-    for(Agent agent : model->agents)
+    for(std::size_t i = 0; i < model->agents.size(); i++)
     {
-        agents.push_back(std::pair<int, int>(agent.x, agent.y));
+        agents.push_back(std::pair<int, int>(model->agents.x[i], model->agents.y[i]));
     }
 }
 
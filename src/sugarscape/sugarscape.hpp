@@ -23,15 +23,48 @@
 
 #include "../ModelCA.hpp"
 
+#include <cstdint>
+#include <random>
 #include <utility>
 #include <vector>
 
-struct Agent
+/**
+ * The agents of a Sugarscape, stored as one array per attribute,
+ * so that a pass over one attribute doesn't drag in the others.
+ */
+struct Agents
 {
-    Agent(int x, int y);
+    std::vector<int> x, y;
+    std::vector<int> sugar, vision, metabolism;
+
+    std::size_t size() const;
+    void clear();
+
+    /** Adds an agent at (x, y), with random sugar, vision and metabolism. */
+    void add(int x, int y);
+
+    /**
+     * Removes agent `i` by moving the last agent into its place. Returns
+     * the index the last agent had, which is `i` if it was the last.
+     */
+    std::size_t remove(std::size_t i);
+};
 
-    int x, y;
-    int sugar, vision, metabolism;
+/**
+ * The sugar capacity of each cell, read from a binary (P5) PGM file,
+ * scaled so that the file's maximum value holds 4 sugar, or from a raw
+ * file of width * height bytes, each holding a capacity from 0 to 4.
+ */
+struct Landscape
+{
+    /**
+     * Reads the landscape at `path`. The size of a raw file must be given;
+     * a PGM file gives its own. Returns false if the file can't be read.
+     */
+    bool load(const char* path, int width, int height);
+
+    int width = 0, height = 0;
+    std::vector<unsigned char> capacity;
 };
 
 class Sugarscape;
@@ -48,38 +81,84 @@ struct SugarscapeFrame : public ModelFrame
 class Sugarscape : public ModelCA
 {
     public:
-        template<typename T>
-        static void shuffle(std::size_t count, T* array)
-        {
-            while(count)
-            {
-                std::size_t index = rand() % count--;
-
-                T temp = array[count];
-                array[count] = array[index];
-                array[index] = temp;
-            }
-        }
-
-        Sugarscape(int width, int height, int agents);
+        /** The furthest any agent can see. */
+        static const int MAX_VISION = 6;
+
+        /** If `landscape` is null, two sugarspots are placed on the grid instead. */
+        Sugarscape(int width, int height, int agents, bool tiled, int morton, const Landscape* landscape);
         ~Sugarscape();
 
         void sugarspot(int cx, int cy);
-        bool empty(int x, int y);
-        void move(Agent& agent);
+        /** Moves agent `i`, breaking ties between its options with `random`. */
+        void move(std::size_t i, std::uint64_t random);
 
         void init();
 
+        /** Returns the sugar in cell `i`, growing it back since it was last harvested. */
+        int available(int i) const;
+
         ModelFrame* frame();
         bool update();
         void render(SDL_Surface* surface, SDL_Rect* dest, const ModelFrame* frame);
 
     private:
-        std::vector<Agent> agents;
+        Agents agents;
         unsigned char* capacity;
 
         int nagents;
 
+        /** The capacities to start with, if they weren't generated. */
+        std::vector<unsigned char> landscape;
+
+        /** The order in which agents act during a step, shuffled each step. */
+        std::vector<int> order;
+        std::mt19937 random;
+
+        /** The cell of each agent, and the sugar it finds there, for the harvest. */
+        std::vector<int> site, harvest;
+
+        /**
+         * When true, the grid is split into square tiles twice as wide as
+         * the furthest any agent can see, coloured like a checkerboard with
+         * four colours. Agents in tiles of the same colour can't see any of
+         * the same cells, so each colour's tiles are moved in parallel.
+         */
+        bool tiled;
+
+        /**
+         * Every `morton` steps (if not 0), the agents are sorted along a Z-order
+         * curve, so agents which are near each other on the grid are also near
+         * each other in memory. The order in which the agents act is then
+         * shuffled in blocks of `BLOCK` agents: the blocks act in a random order,
+         * and the agents within each block act in a random order.
+         */
+        int morton;
+        static const int BLOCK = 64;
+
+        /** Sorts the agents by the Morton code of their position. */
+        void sort();
+
+        std::vector<std::pair<std::uint64_t, int>> codes;
+        std::vector<int> scratch;
+
+        /** The agents starting each step in each tile, in the order they act. */
+        std::vector<int> tile_start, tile_end, tile_agents;
+
+        /** Ties are broken by hashing these with the agent, as `rand()` can't be shared between threads. */
+        std::uint64_t stream;
+        std::uint64_t steps;
+
+        /**
+         * The step in which each cell was last harvested. Rather than
+         * regrowing every cell each step, `cells` holds what was left
+         * after the last harvest, and `available()` adds one unit for
+         * each step since, up to the cell's capacity.
+         */
+        std::vector<std::uint32_t> harvested;
+
+        /** The index in `agents` of the agent in each cell, or -1 if the cell is empty. */
+        std::vector<int> occupant;
+
     friend SugarscapeFrame::SugarscapeFrame(const Sugarscape*);
 };
 
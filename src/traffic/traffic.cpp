@@ -22,6 +22,9 @@
 #include "../ModelCA.hpp"
 #include "../Viewer.hpp"
 
+#include <algorithm>
+#include <chrono>
+
 #include <cstdlib>
 #include <cstring>
 #include <cstdio>
@@ -37,23 +40,21 @@ int main(int argc, char** argv)
         printf("-w width height (width and height of the viewer window. Default 800x600)\n");
         printf("-f              (makes the viewer window fullscreen)\n");
         printf("-fps fps        (frames per second of the viewer window. Default 30)\n");
+        printf("-spf steps      (the number of steps the model takes between frames. Default 1)\n");
         printf("-s width height (width and height of the model. Default 60x40)\n");
         printf("-d percent      (the percentage of cells which contain 'cars'. Each car is equally likely to be red or blue. Default 0.3)\n");
+        printf("-frontier       (only visit cars which might be able to move. Faster for jammed lattices)\n");
+        printf("-bench steps    (runs the model for the given number of steps without a viewer, and prints the time taken)\n");
         printf("-seed seed      (the seed used for pseudo-random number generation. Default RANDOM)\n");
         return 0;
     }
 
-    // 1) Initialise model viewer.
-    if(!Viewer::Init("Biham-Middleton-Levine traffic model", argc, argv))
-    {
-        fprintf(stderr, "Failed to initialise model viewer!\n");
-        return 1;
-    }
-
-    // 2) Parse command-line arguments.
+    // 1) Parse command-line arguments.
     int seed = 0;
     int width = 60, height = 40;
     float density = 0.3f;
+    int bench = 0;
+    bool frontier = false;
     for(int i = 0; i < argc; i++)
     {
         if(strcmp(argv[i], "-s") == 0)
@@ -65,19 +66,45 @@ int main(int argc, char** argv)
         {
             density = atof(argv[i + 1]);
         }
+        else if(strcmp(argv[i], "-frontier") == 0)
+        {
+            frontier = true;
+        }
+        else if(strcmp(argv[i], "-bench") == 0)
+        {
+            bench = atoi(argv[i + 1]);
+        }
         else if(strcmp(argv[i], "-seed") == 0)
         {
             seed = atoi(argv[i + 1]);
         }
     }
 
-    // 3) Initialise the model.
+    // 2) Initialise the model.
     if(seed) srand(seed);
     else srand(time(NULL));
 
-    Traffic traffic = Traffic(width, height, density);
+    Traffic traffic = Traffic(width, height, density, frontier);
+
+    // 3) Without a viewer, time the model and quit.
+    if(bench)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for(int i = 0; i < bench; i++) traffic.update();
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+        printf("%d steps of %dx%d in %.3f ms (%.3f ms/step)\n", bench, width, height, elapsed.count(), elapsed.count() / bench);
+        return 0;
+    }
 
-    // 4) Attach the model to a viewer.
+    // 4) Initialise model viewer.
+    if(!Viewer::Init("Biham-Middleton-Levine traffic model", argc, argv))
+    {
+        fprintf(stderr, "Failed to initialise model viewer!\n");
+        return 1;
+    }
+
+    // 5) Attach the model to a viewer.
     Viewer::Get()->run(&traffic);
     Viewer::Quit();
     return 0;
@@ -90,8 +117,22 @@ const SDL_Colour ModelCA::COLOURS[3] = {
     {0x40, 0x40, 0xFF, 0xFF}
 };
 
-Traffic::Traffic(int _width, int _height, float _density) : ModelCA(_width, _height), density(_density)
+Traffic::Traffic(int _width, int _height, float _density, bool _frontier)
+    : ModelCA(_width, _height), density(_density), stride((_width + 63) / 64), frontier(_frontier)
 {
+    last = ~UINT64_C(0) >> (63 - (_width - 1) % 64);
+
+    if(frontier)
+    {
+        queued.resize(_width * _height);
+    }
+    else
+    {
+        red.resize(stride * _height);
+        blue.resize(stride * _height);
+        scratch.resize(2 * stride);
+    }
+
     init();
 }
 
@@ -101,43 +142,217 @@ void Traffic::init()
     unsigned char choices[3] = {EMPTY, RED, BLUE};
     float weights[3] = {1.0f - density, density / 2, density / 2};
     init_cells(3, choices, weights);
+
+    if(frontier)
+    {
+        // To begin with, any car might be able to move.
+        ahead_red.clear();
+        ahead_blue.clear();
+        std::fill(queued.begin(), queued.end(), 0);
+
+        for(int i = 0, end = width * height; i < end; i++)
+            queue(i);
+    }
+    else
+    {
+        pack();
+    }
 }
 
-bool Traffic::update()
+void Traffic::pack()
 {
-    unsigned char* old_cells = new unsigned char[width * height];
-    std::memcpy(old_cells, cells, width * height);
+    std::fill(red.begin(), red.end(), 0);
+    std::fill(blue.begin(), blue.end(), 0);
 
-    // Move all red cars.
-    for(int i = 0, end = width * height; i < end; i++)
+    for(int y = 0; y < height; y++)
     {
-        if(old_cells[i] == RED)
+        for(int x = 0; x < width; x++)
         {
-            std::size_t next = (i / width) * width + ((i + 1) % width);
-            if(old_cells[next] == EMPTY)
-            {
-                cells[next] = RED;
-                cells[i] = EMPTY;
-            }
+            std::uint64_t bit = UINT64_C(1) << (x % 64);
+            if(cell(x, y) == RED) red[y * stride + x / 64] |= bit;
+            else if(cell(x, y) == BLUE) blue[y * stride + x / 64] |= bit;
         }
     }
 
-    std::memcpy(old_cells, cells, width * height);
+    stale = false;
+}
+
+void Traffic::unpack()
+{
+    if(!stale) return;
 
-    // Move all blue cars.
-    for(int i = 0, end = width * height; i < end; i++)
+    for(int y = 0; y < height; y++)
     {
-        if(old_cells[i] == BLUE)
+        for(int x = 0; x < width; x++)
         {
-            std::size_t next = ((i / width) + 1) % height * width + (i % width);
-            if(old_cells[next] == EMPTY)
-            {
-                cells[next] = BLUE;
-                cells[i] = EMPTY;
-            }
+            std::uint64_t bit = UINT64_C(1) << (x % 64);
+            if(red[y * stride + x / 64] & bit) cell(x, y) = RED;
+            else if(blue[y * stride + x / 64] & bit) cell(x, y) = BLUE;
+            else cell(x, y) = EMPTY;
         }
     }
 
-    delete[] old_cells;
-    return false;
+    stale = false;
+}
+
+bool Traffic::move_red()
+{
+    // Bit of the rightmost cell in the last word of a row.
+    const int top = (width - 1) % 64;
+
+    std::uint64_t moved = 0;
+    for(int y = 0; y < height; y++)
+    {
+        std::uint64_t* r = &red[y * stride];
+        const std::uint64_t* b = &blue[y * stride];
+
+        // The first word is overwritten before the last word
+        // wraps around to read it, so remember it.
+        const std::uint64_t first = r[0] | b[0];
+
+        std::uint64_t carry = 0;
+        for(std::size_t w = 0; w + 1 < stride; w++)
+        {
+            // Bit i of `ahead` is set iff the cell right of bit i is occupied.
+            std::uint64_t ahead = ((r[w] | b[w]) >> 1) | ((r[w + 1] | b[w + 1]) << 63);
+            std::uint64_t go = r[w] & ~ahead;
+
+            r[w] = (r[w] & ~go) | (go << 1) | carry;
+            carry = go >> 63;
+            moved |= go;
+        }
+
+        // The last word wraps around to the first.
+        std::size_t w = stride - 1;
+        std::uint64_t ahead = ((r[w] | b[w]) >> 1) | ((first & 1) << top);
+        std::uint64_t go = r[w] & ~ahead;
+
+        r[w] = ((r[w] & ~go) | (go << 1) | carry) & last;
+        r[0] |= (go >> top) & 1;
+        moved |= go;
+    }
+
+    return moved != 0;
+}
+
+bool Traffic::move_blue()
+{
+    std::uint64_t* first = &scratch[0];
+    std::uint64_t* incoming = &scratch[stride];
+
+    // The first row is overwritten before the last row
+    // wraps around to read it, so remember it.
+    for(std::size_t w = 0; w < stride; w++)
+    {
+        first[w] = red[w] | blue[w];
+        incoming[w] = 0;
+    }
+
+    std::uint64_t moved = 0;
+    for(int y = 0; y < height; y++)
+    {
+        std::uint64_t* b = &blue[y * stride];
+        const std::uint64_t* nr = &red[((y + 1) % height) * stride];
+        const std::uint64_t* nb = &blue[((y + 1) % height) * stride];
+        bool wrap = (y + 1 == height);
+
+        for(std::size_t w = 0; w < stride; w++)
+        {
+            std::uint64_t below = wrap ? first[w] : (nr[w] | nb[w]);
+            std::uint64_t go = b[w] & ~below;
+
+            // Cars arriving from the row above are only added once this
+            // row's cars have moved, so that nothing moves twice.
+            b[w] = (b[w] & ~go) | incoming[w];
+            incoming[w] = go;
+            moved |= go;
+        }
+    }
+
+    for(std::size_t w = 0; w < stride; w++)
+        blue[w] |= incoming[w];
+
+    return moved != 0;
+}
+
+void Traffic::queue(int i)
+{
+    // A cell can be queued once for each colour: a car might
+    // leave while queued, and another arrive in its place.
+    unsigned char colour = cells[i];
+    if(colour == EMPTY || (queued[i] & colour)) return;
+
+    queued[i] |= colour;
+    if(colour == RED) ahead_red.push_back(i);
+    else ahead_blue.push_back(i);
+}
+
+bool Traffic::move_queued(unsigned char colour, std::vector<int>& ahead)
+{
+    // Find the queued cars which can move. The rest stay blocked until
+    // the cell ahead of them empties, at which point they are queued again.
+    moving.clear();
+    for(int i : ahead)
+    {
+        queued[i] &= ~colour;
+
+        if(cells[i] != colour) continue;
+
+        int x = i % width, y = i / width;
+        int next = (colour == RED) ? y * width + (x + 1) % width : ((y + 1) % height) * width + x;
+        if(cells[next] == EMPTY) moving.push_back(i);
+    }
+
+    ahead.clear();
+
+    // Every car moves into a cell which was empty before this
+    // half-step, so the moves don't interfere with each other.
+    for(int i : moving)
+    {
+        int x = i % width, y = i / width;
+        int next = (colour == RED) ? y * width + (x + 1) % width : ((y + 1) % height) * width + x;
+
+        cells[next] = colour;
+        cells[i] = EMPTY;
+
+        // The car may be able to move again, as may any
+        // car which was waiting for it to leave.
+        queue(next);
+        queue(y * width + (x + width - 1) % width);
+        queue(((y + height - 1) % height) * width + x);
+    }
+
+    return !moving.empty();
+}
+
+bool Traffic::update()
+{
+    if(frontier)
+    {
+        bool moved = move_queued(RED, ahead_red);
+        moved |= move_queued(BLUE, ahead_blue);
+
+        // Return true iff the traffic is completely jammed.
+        return !moved;
+    }
+
+    bool moved = move_red();
+    moved |= move_blue();
+
+    stale = true;
+
+    // Return true iff the traffic is completely jammed.
+    return !moved;
+}
+
+ModelFrame* Traffic::frame()
+{
+    unpack();
+    return ModelCA::frame();
+}
+
+void Traffic::render(SDL_Surface* surface, SDL_Rect* dest, const ModelFrame* frame)
+{
+    if(frame == nullptr) unpack();
+    ModelCA::render(surface, dest, frame);
 }
@@ -22,21 +22,75 @@
 
 #include "../ModelCA.hpp"
 
+#include <cstdint>
+#include <vector>
+
 class Traffic : public ModelCA
 {
     public:
-        Traffic(int _width, int _height, float _density);
+        Traffic(int _width, int _height, float _density, bool _frontier);
         ~Traffic() {}
 
         void init();
         bool update();
 
+        ModelFrame* frame();
+        void render(SDL_Surface* surface, SDL_Rect* dest, const ModelFrame* frame=nullptr);
+
     private:
         const unsigned char EMPTY = 0,
                             RED = 1,
                             BLUE = 2;
 
+        /** Copies `cells` into the red and blue bit planes. */
+        void pack();
+
+        /** Copies the bit planes back into `cells`, if they have changed since the last copy. */
+        void unpack();
+
+        /** Moves every red car one cell right, if it can. Returns true iff any car moved. */
+        bool move_red();
+
+        /** Moves every blue car one cell down, if it can. Returns true iff any car moved. */
+        bool move_blue();
+
+        /**
+         * Like `move_red()` and `move_blue()`, but only visits the cars
+         * queued in `ahead`, and queues the cars which may be able to move
+         * as a result. Works directly on `cells`.
+         */
+        bool move_queued(unsigned char colour, std::vector<int>& ahead);
+
+        /** Queues the car in cell `i`, if any, to be checked on its next half-step. */
+        void queue(int i);
+
         float density;
+
+        /**
+         * Bit (x % 64) of word (y * stride + x / 64) is set iff
+         * cell (x, y) contains a red car (or a blue car). Bits past
+         * the end of each row are always clear.
+         */
+        std::vector<std::uint64_t> red, blue;
+        std::vector<std::uint64_t> scratch;
+
+        std::size_t stride;
+        std::uint64_t last;
+
+        bool stale = false;
+
+        /**
+         * When true, the bit planes are not used. Instead, only cars which
+         * might be able to move are visited: every car with an empty cell
+         * ahead of it is always in `ahead_red` or `ahead_blue`, so a
+         * jammed lattice costs next to nothing to update. `RED` and `BLUE`
+         * double as the bits of `queued` which mark a cell as being in
+         * `ahead_red` or `ahead_blue`.
+         */
+        bool frontier;
+
+        std::vector<int> ahead_red, ahead_blue, moving;
+        std::vector<unsigned char> queued;
 };
 
 #endif // TRAFFIC_HPP